@@ -0,0 +1,8 @@
+// State of the physical page allocator, as returned by
+// the buddyinfo system call.
+struct buddyinfo {
+  uint nfree[MAXORDER+1]; // Free blocks of 2^i pages.
+  uint npage;             // Pages managed by the allocator.
+  uint ncached;           // Free pages in per-CPU caches.
+  uint nzero;             // Pages in the zeroed page pool.
+};
@@ -0,0 +1,35 @@
+#include "types.h"
+#include "param.h"
+#include "user.h"
+#include "buddy.h"
+
+// Print the free blocks of each order in the kernel's buddy
+// allocator and how fragmented free memory is: for each
+// order, the percentage of free pages that sit in blocks too
+// small to satisfy an allocation of that order.
+
+int main(int argc, char *argv[]) {
+    struct buddyinfo bi;
+    uint free, usable;
+    int i, j;
+
+    if(buddyinfo(&bi) < 0) {
+        printf(2, "buddyinfo: failed\n");
+        exit();
+    }
+    free = 0;
+    for(i = 0; i <= MAXORDER; i++)
+        free += bi.nfree[i] << i;
+
+    printf(1, "%s %s %s %s\n", "order", "pages", "free", "unusable");
+    for(i = 0; i <= MAXORDER; i++) {
+        usable = 0;
+        for(j = i; j <= MAXORDER; j++)
+            usable += bi.nfree[j] << j;
+        printf(1, "%d %d %d %d%%\n", i, 1 << i, bi.nfree[i],
+               free ? (free - usable) * 100 / free : 0);
+    }
+    printf(1, "%d of %d pages free, %d cached per-CPU, %d pre-zeroed\n",
+           free, bi.npage, bi.ncached, bi.nzero);
+    exit();
+}
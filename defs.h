@@ -1,14 +1,27 @@
+struct buddyinfo;
 struct buf;
 struct context;
 struct file;
+struct image;
 struct inode;
+struct lockstat;
+struct memstat;
 struct pipe;
 struct proc;
+struct procmem;
+struct rwlock;
+struct segment;
+struct seqlock;
+struct profsample;
 struct rtcdate;
+struct slabcache;
 struct spinlock;
+struct shm;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct trapframe;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -24,6 +37,8 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             loadimage(char*, char**, struct image*);
+int             loadseg(struct inode*, struct segment*, uint, char*);
 
 // file.c
 struct file*    filealloc(void);
@@ -40,7 +55,8 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
-void            iinit(int dev);
+void            fsinit(int);
+void            iinit(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
@@ -53,6 +69,11 @@ int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint, uint);
+int             futexwake(uint, int);
+
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
@@ -64,10 +85,17 @@ extern uchar    ioapicid;
 void            ioapicinit(void);
 
 // kalloc.c
+void            buddyinfo(struct buddyinfo*);
 char*           kalloc(void);
+char*           kalloc_order(int);
+char*           kalloc_zeroed(void);
 void            kfree(char*);
+void            kfree_order(char*, int);
+void            kincref(char*);
+int             krefcnt(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kzero(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -78,6 +106,7 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicsettimer(int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -87,6 +116,17 @@ void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
 
+// mmap.c
+int             addvma(uint, uint, int, int, struct file*, uint, struct shm*);
+struct vma*     findvma(struct proc*, uint);
+int             mmap(uint, uint, int, int, struct file*, uint);
+int             munmap(uint, uint);
+void            vmaclose(struct proc*);
+int             vmacopy(struct proc*, pde_t*, int);
+void            vmadup(struct proc*, struct proc*);
+char*           vmapage(struct vma*, uint);
+int             vmapopulate(struct proc*);
+
 // mp.c
 extern int      ismp;
 void            mpinit(void);
@@ -98,24 +138,42 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+void            pipeinit(void);
+uint            pipepages(void);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
+// profile.c
+int             profctl(int, int);
+void            profinit(void);
+int             profread(struct profsample*, int);
+int             proftick(struct trapframe*);
+
 //PAGEBREAK: 16
 // proc.c
+int             clone(void(*)(void*), void*, void*);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             join(void**);
 int             kill(int);
+uint            memend(struct proc*, uint);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
+int             pagefault(uint, int);
 void            pinit(void);
+void            preempt(int);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
+int             spawn(char*, char**, int*);
 void            sleep(void*, struct spinlock*);
+int             swapscan(char**, uint*, int);
+pde_t*          swappgdir(struct proc*, pde_t*);
+struct spinlock* vmlock(pde_t*);
+int             vmshared(struct proc*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
@@ -123,6 +181,7 @@ void            yield(void);
 int             waitx(int*, int*);
 int             set_priority(int, int);
 int             ps_func(void);
+int             memstat(struct memstat*, struct procmem*, int);
 void            demote_q(struct proc* p);
 void            inc_q_ticks(struct proc *p);
 void            inc_r_io_time(void);
@@ -131,13 +190,52 @@ void            swtch(struct context**, struct context*);
 
 // spinlock.c
 void            acquire(struct spinlock*);
+void            acquireread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            freelock(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initrwlock(struct rwlock*, char*);
+void            initseqlock(struct seqlock*, char*);
+int             lockstatread(struct lockstat*, int, int);
+int             locktorture(int);
 void            release(struct spinlock*);
+void            releaseread(struct rwlock*);
+void            releasewrite(struct rwlock*);
+uint            seqreadbegin(struct seqlock*);
+int             seqreadretry(struct seqlock*, uint);
+void            seqwritebegin(struct seqlock*);
+void            seqwriteend(struct seqlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// shm.c
+struct shm*     shmanon(uint);
+int             shmat(int);
+void            shmclose(struct shm*);
+int             shmdt(uint);
+void            shmdup(struct shm*);
+int             shmget(int, uint);
+void            shminit(void);
+char*           shmpage(struct shm*, uint);
+int             shmrm(int);
+
+// slab.c
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+void            slabinit(struct slabcache*, char*, uint);
+uint            slabpages(struct slabcache*);
+
+// swap.c
+int             swapalloc(char*);
+void            swapdup(int);
+void            swapfree(int);
+int             swapin(pde_t*, uint);
+void            swapinit(int);
+void            swapstat(uint*, uint*);
+int             swapout(int);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -156,9 +254,10 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
-int             argstr(int, char**);
+int             argrptr(int, char**, int);
+int             argstr(int, char*, int);
 int             fetchint(uint, int*);
-int             fetchstr(uint, char**);
+int             fetchstr(uint, char*, int);
 void            syscall(void);
 
 // timer.c
@@ -168,28 +267,45 @@ void            timerinit(void);
 void            idtinit(void);
 extern uint     ticks;
 void            tvinit(void);
-extern struct spinlock tickslock;
+extern struct seqlock tickslock;
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// vdso.c
+void            vdsoinit(void);
+int             vdsomap(pde_t*, int);
+void            vdsosetpid(pde_t*, int);
+void            vdsotick(uint);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
+int             mappages(pde_t*, void*, uint, uint, int);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+pde_t*          cowuvm(pde_t*, uint);
+char*           dirtypage(pde_t*, char*);
+int             dupuvm(pde_t*, pde_t*, uint, uint, int, int);
+int             uncowuvm(pde_t*, uint);
+int             vmfault(pde_t*, uint, int, char*, int);
+char*           vmevict(pde_t*, uint*, uint, uint*);
+int             vmswapped(pde_t*, uint);
+int             vmswapin(pde_t*, uint, int, char*);
+void            vmcount(pde_t*, uint*, uint*, uint*);
+uint            pgtabpages(void);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
+void            idlekvm(void);
+void            flushuvm(void);
 int             copyout(pde_t*, uint, void*, uint);
-void            clearpteu(pde_t *pgdir, char *uva);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
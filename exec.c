@@ -2,22 +2,27 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
 
+// Load the program at path into a new page table with argv on
+// its stack, filling in im.  The stack region is as large as
+// the current process's stack limit.  Only the top page of the
+// stack is allocated now; the rest of the stack is mapped as it
+// grows, and text and data are paged in from the executable.
 int
-exec(char *path, char **argv)
+loadimage(char *path, char **argv, struct image *im)
 {
   char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
+  int i, off, nseg;
+  uint argc, sz, sp, stackbase, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  pde_t *pgdir;
 
   begin_op();
 
@@ -28,6 +33,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  exe = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -35,11 +41,15 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pgdir = setupkvm()) == 0)
+  if((pgdir = setupkvm()) == 0 || vdsomap(pgdir, 0) < 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments; pagefault() reads
+  // each page from ip the first time it is touched.  They
+  // must end below the stack region and its guard page.
+  stackbase = USTACKTOP - myproc()->stacklimit;
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -47,31 +57,38 @@ exec(char *path, char **argv)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz > stackbase - PGSIZE)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < sz)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.off + ph.filesz < ph.off)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg >= NSEG)
       goto bad;
+    im->seg[nseg].va = ph.vaddr;
+    im->seg[nseg].off = ph.off;
+    im->seg[nseg].filesz = ph.filesz;
+    im->seg[nseg].memsz = ph.memsz;
+    nseg++;
+    sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // Keep the reference to ip for paging.
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
+  // The heap starts at the next page boundary.
   sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
-    goto bad;
-  clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
-  sp = sz;
+  sp = USTACKTOP;
 
   // Push argument strings, prepare rest of stack in ustack.
+  // They must fit in the top page of the stack.
   for(argc = 0; argv[argc]; argc++) {
     if(argc >= MAXARG)
       goto bad;
+    if(strlen(argv[argc]) >= sp - (USTACKTOP - PGSIZE))
+      goto bad;
     sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
     if(copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
       goto bad;
@@ -84,23 +101,22 @@ exec(char *path, char **argv)
   ustack[2] = sp - (argc+1)*4;  // argv pointer
 
   sp -= (3+argc+1) * 4;
-  if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
+  if(sp < USTACKTOP - PGSIZE || copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
-
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  safestrcpy(im->name, last, sizeof(im->name));
+
+  im->pgdir = pgdir;
+  im->sz = sz;
+  im->entry = elf.entry;
+  im->sp = sp;
+  im->stackbase = stackbase;
+  im->exe = exe;
+  im->nseg = nseg;
   return 0;
 
  bad:
@@ -110,5 +126,69 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
+
+int
+exec(char *path, char **argv)
+{
+  struct image im;
+  struct inode *oldexe;
+  pde_t *oldpgdir;
+  struct proc *curproc = myproc();
+
+  if(loadimage(path, argv, &im) < 0)
+    return -1;
+  vdsosetpid(im.pgdir, curproc->pid);
+
+  // Commit to the user image.  Other threads keep
+  // running in the old one.
+  safestrcpy(curproc->name, im.name, sizeof(curproc->name));
+  vmaclose(curproc);
+  curproc->sz = im.sz;
+  curproc->stackbase = im.stackbase;
+  oldpgdir = swappgdir(curproc, im.pgdir);
+  oldexe = curproc->exe;
+  curproc->exe = im.exe;
+  memmove(curproc->seg, im.seg, sizeof(im.seg));
+  curproc->nseg = im.nseg;
+  curproc->tf->eip = im.entry;  // main
+  curproc->tf->esp = im.sp;
+  switchuvm(curproc);
+  if(oldpgdir)
+    freevm(oldpgdir);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
+  return 0;
+}
+
+// Read the page at va of segment s of executable ip into
+// mem, which is a zeroed page.  Called by pagefault() the
+// first time the page is touched.
+int
+loadseg(struct inode *ip, struct segment *s, uint va, char *mem)
+{
+  uint off, n;
+
+  off = va - s->va;
+  if(off >= s->filesz)
+    return 0;
+  n = s->filesz - off;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  ilock(ip);
+  if(readi(ip, mem, s->off + off, n) != n){
+    iunlock(ip);
+    return -1;
+  }
+  iunlock(ip);
+  return 0;
+}
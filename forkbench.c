@@ -0,0 +1,71 @@
+#include "types.h"
+#include "user.h"
+
+// Fork/exec storm.  Runs nproc processes in parallel, each
+// forking n children that exit at once (or, with -e, exec
+// "forkbench -x" first, which just exits; with -s, spawn
+// it instead), and reports how many clock ticks the whole
+// storm took.
+//
+//   forkbench [-e|-s] [nproc] [n]
+
+int main(int argc, char *argv[]) {
+    int nproc, n, doexec, dospawn, i, j, pid, start;
+    char *args[] = { "forkbench", "-x", 0 };
+
+    if(argc > 1 && strcmp(argv[1], "-x") == 0)
+        exit();
+    doexec = dospawn = 0;
+    if(argc > 1 && strcmp(argv[1], "-e") == 0) {
+        doexec = 1;
+        argc--;
+        argv++;
+    } else if(argc > 1 && strcmp(argv[1], "-s") == 0) {
+        dospawn = 1;
+        argc--;
+        argv++;
+    }
+    nproc = argc > 1 ? atoi(argv[1]) : 8;
+    n = argc > 2 ? atoi(argv[2]) : 100;
+    if(nproc < 1 || n < 1) {
+        printf(2, "usage: forkbench [-e|-s] [nproc] [n]\n");
+        exit();
+    }
+
+    start = uptime();
+    for(i = 0; i < nproc; i++) {
+        if((pid = fork()) < 0) {
+            printf(2, "forkbench: fork failed\n");
+            break;
+        }
+        if(pid == 0) {
+            for(j = 0; j < n; j++) {
+                if(dospawn) {
+                    if(spawn(args[0], args, 0) < 0) {
+                        printf(2, "forkbench: spawn failed\n");
+                        exit();
+                    }
+                    wait();
+                    continue;
+                }
+                if((pid = fork()) < 0) {
+                    printf(2, "forkbench: fork failed\n");
+                    exit();
+                }
+                if(pid == 0) {
+                    if(doexec)
+                        exec(args[0], args);
+                    exit();
+                }
+                wait();
+            }
+            exit();
+        }
+    }
+    while(wait() >= 0)
+        ;
+    printf(1, "%d procs x %d %s: %d ticks\n", nproc, n,
+           dospawn ? "spawn" : doexec ? "fork+exec" : "fork",
+           uptime() - start);
+    exit();
+}
@@ -0,0 +1,48 @@
+#include "types.h"
+#include "param.h"
+#include "fs.h"
+#include "user.h"
+#include "memstat.h"
+
+// Print how memory is used, in KB: free and used memory and
+// swap, what the kernel holds, and with -p, each process's
+// resident and swapped-out memory and page tables.  Threads,
+// which share their creator's page table, are marked with *.
+//
+//   free [-p]
+
+#define KB(n) ((n) * 4)   // pages to KB
+
+struct procmem pm[NPROC];
+
+int main(int argc, char *argv[]) {
+    struct memstat ms;
+    uint used, kernel;
+    int i, n;
+
+    if((n = memstat(&ms, pm, NPROC)) < 0) {
+        printf(2, "free: memstat failed\n");
+        exit();
+    }
+    used = ms.npage - ms.nfree;
+    kernel = ms.npgtab + ms.nkstack + ms.nslab;
+
+    printf(1, "%s %s %s %s\n", "", "total", "used", "free");
+    printf(1, "mem: %d %d %d\n", KB(ms.npage), KB(used), KB(ms.nfree));
+    printf(1, "swap: %d %d %d\n", KB(ms.nswap), KB(ms.nswap - ms.nswapfree),
+           KB(ms.nswapfree));
+    printf(1, "page tables %d, kernel stacks %d, slabs %d (pipes %d), user %d\n",
+           KB(ms.npgtab), KB(ms.nkstack), KB(ms.nslab), KB(ms.npipe),
+           KB(used > kernel ? used - kernel : 0));
+    printf(1, "buffer cache %d, outside the allocator\n", ms.nbuf * BSIZE / 1024);
+
+    if(argc < 2 || strcmp(argv[1], "-p") != 0)
+        exit();
+    printf(1, "\n%s %s %s %s %s %s %s\n", "PID", "name", "size", "stack", "rss",
+           "swap", "pgtab");
+    for(i = 0; i < n; i++)
+        printf(1, "%d %s%s %d %d %d %d %d\n", pm[i].pid, pm[i].name,
+               pm[i].thread ? "*" : "", pm[i].sz / 1024, pm[i].stack / 1024,
+               KB(pm[i].rss), KB(pm[i].swap), KB(pm[i].pgtab));
+    exit();
+}
@@ -14,12 +14,13 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
-#include "proc.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -154,30 +155,39 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// In-memory inodes come from a slab cache, so there is no
+// fixed limit on how many can be in use.  They are kept in a
+// hash table by dev and inum while referenced, and freed when
+// the last reference is dropped (the buffer cache still holds
+// the on-disk inode).
+//
+// The icache.lock spin-lock protects the hash table.  Since
+// ip->ref decides when an entry is freed, and ip->dev and
+// ip->inum decide where it is hashed, one must hold icache.lock
+// while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum and next.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct slabcache cache;
 } icache;
 
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 void
-iinit(int dev)
+iinit(void)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  slabinit(&icache.cache, "inode", sizeof(struct inode));
+}
 
+void
+fsinit(int dev)
+{
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
@@ -241,31 +251,42 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, *nip;
+  struct inode **bucket;
 
-  acquire(&icache.lock);
+  bucket = &icache.hash[IHASH(dev, inum)];
+  nip = 0;
+  for(;;){
+    acquire(&icache.lock);
 
-  // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
+    // Is the inode already cached?
+    for(ip = *bucket; ip; ip = ip->next){
+      if(ip->dev == dev && ip->inum == inum){
+        ip->ref++;
+        release(&icache.lock);
+        if(nip)
+          slabfree(&icache.cache, nip);
+        return ip;
+      }
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
+    if(nip)
+      break;
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+    // Allocate a new entry without holding icache.lock,
+    // then look again in case another process beat us.
+    release(&icache.lock);
+    if((nip = slaballoc(&icache.cache)) == 0)
+      panic("iget: no inodes");
+  }
 
-  ip = empty;
+  ip = nip;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  initsleeplock(&ip->lock, "inode");
+  ip->next = *bucket;
+  *bucket = ip;
   release(&icache.lock);
 
   return ip;
@@ -331,6 +352,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquiresleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
@@ -347,8 +370,16 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref > 0){
+    release(&icache.lock);
+    return;
+  }
+  for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
   release(&icache.lock);
+  freelock(&ip->lock.lk);
+  slabfree(&icache.cache, ip);
 }
 
 // Common idiom: unlock, then put.
@@ -0,0 +1,134 @@
+// Futexes: let user code block on a memory word.
+//
+// futexwait(addr, val) sleeps only if *addr still equals val,
+// and futexwake(addr, n) wakes up to n processes waiting on
+// addr.  Waiters are keyed by the physical address of the word,
+// so processes sharing a page through different virtual
+// addresses still meet, and are kept in hashed buckets, each
+// with its own lock.  Checking *addr and queueing happen under
+// the bucket lock, so a wake between the user's check and the
+// kernel's cannot be lost.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "proc.h"
+
+struct futexwaiter {
+  uint key;                   // physical address of the word
+  int woken;
+  struct futexwaiter *next;
+};
+
+struct futexbucket {
+  struct spinlock lock;
+  struct futexwaiter *head;
+};
+
+static struct futexbucket futextab[NFUTEXHASH];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEXHASH; i++)
+    initlock(&futextab[i].lock, "futex");
+}
+
+// Physical address of the word at user address addr, or 0
+// if addr is not an aligned word of the heap, the stack or a
+// memory mapping.  The page is faulted in first, and its
+// copy-on-write broken if it is writable, so that waiters and
+// wakers find the page the word will stay in.
+static uint
+futexkey(uint addr)
+{
+  struct proc *p = myproc();
+  char *ka;
+  uint ep;
+
+  if(addr % sizeof(uint) != 0)
+    return 0;
+  if(((ep = memend(p, addr)) == 0 || addr + sizeof(uint) > ep) &&
+     findvma(p, addr) == 0)
+    return 0;
+  if(pagefault(addr, 1) < 0 && pagefault(addr, 0) < 0)
+    return 0;
+  if((ka = uva2ka(p->pgdir, (char*)PGROUNDDOWN(addr))) == 0)
+    return 0;
+  return V2P(ka) + (addr % PGSIZE);
+}
+
+static struct futexbucket*
+futexbucket(uint key)
+{
+  return &futextab[(key >> 2) % NFUTEXHASH];
+}
+
+// Sleep until woken by futexwake() on addr, provided
+// *addr == val.  Returns 0 when woken, -1 if *addr != val,
+// addr is bad, or the process was killed.
+int
+futexwait(uint addr, uint val)
+{
+  struct futexbucket *b;
+  struct futexwaiter w, **pp;
+  uint key;
+
+  if((key = futexkey(addr)) == 0)
+    return -1;
+  b = futexbucket(key);
+
+  acquire(&b->lock);
+  if(*(volatile uint*)P2V(key) != val){
+    release(&b->lock);
+    return -1;
+  }
+  w.key = key;
+  w.woken = 0;
+  w.next = b->head;
+  b->head = &w;
+  while(!w.woken && !myproc()->killed)
+    sleep(&w, &b->lock);
+  if(!w.woken){
+    for(pp = &b->head; *pp != &w; pp = &(*pp)->next)
+      ;
+    *pp = w.next;
+  }
+  release(&b->lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n processes waiting on addr.
+// Returns the number woken, or -1 if addr is bad.
+int
+futexwake(uint addr, int n)
+{
+  struct futexbucket *b;
+  struct futexwaiter *w, **pp;
+  uint key;
+  int woken;
+
+  if((key = futexkey(addr)) == 0)
+    return -1;
+  b = futexbucket(key);
+
+  woken = 0;
+  acquire(&b->lock);
+  for(pp = &b->head; (w = *pp) != 0 && woken < n; ){
+    if(w->key != key){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&b->lock);
+  return woken;
+}
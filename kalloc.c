@@ -1,6 +1,13 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers.
+//
+// Memory is managed by a binary buddy allocator: a free block
+// of 2^k pages (order k) is kept on the order-k free list, is
+// aligned to its size, and is merged with its equally sized
+// neighbour (its buddy) whenever both are free.  kalloc_order()
+// hands out such blocks; kalloc() is the single-page fast path
+// and mostly works on per-CPU caches of free pages.
 
 #include "types.h"
 #include "defs.h"
@@ -8,21 +15,61 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "buddy.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+#define NPAGE   (PHYSTOP/PGSIZE)
+#define PGFREE  0x80  // in pgorder[]: first page of a free buddy block
+
 struct run {
   struct run *next;
+  struct run *prev;   // only on the buddy free lists
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER+1];
+  uint nfree[MAXORDER+1];  // blocks on each free list
+  uint npage;              // pages handed to the allocator
 } kmem;
 
+// For the first page of each free block, its order | PGFREE.
+// Zero for every other page, so a block's buddy is free and
+// whole exactly when its entry is order | PGFREE.
+static uchar pgorder[NPAGE];
+
+// Number of references to each page handed out by kalloc().
+// Copy-on-write fork shares user pages between page tables;
+// kfree() only frees a page when its last reference goes.
+// Updated with atomic instructions rather than a lock.
+static ushort pgref[NPAGE];
+
+// Each CPU keeps up to NKCACHE free pages of its own, so most
+// kalloc()/kfree() calls take only that CPU's uncontended lock.
+// A cache refills from and drains to the buddy lists NKCACHE/2
+// pages at a time.  The lock is only for the rare case when
+// another CPU has run out of memory and steals pages.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} __attribute__((aligned(64)));
+
+static struct kcache kcache[NCPU];
+
+// Pages zeroed ahead of time by idle CPUs (see kzero()), so
+// that page tables and new user memory need not be cleared
+// on the allocation path.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} zpool;
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,7 +78,12 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&zpool.lock, "zpool");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -48,32 +100,181 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.npage++;
+    pgref[V2P(p)/PGSIZE] = 1;
     kfree(p);
+  }
+}
+
+static void
+buddypush(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.nfree[order]++;
+  pgorder[V2P(r)/PGSIZE] = order | PGFREE;
+}
+
+static void
+buddyremove(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  pgorder[V2P(r)/PGSIZE] = 0;
+}
+
+// Free the order-sized block at v, merging it with its buddy
+// for as long as the buddy is free too.
+// Caller holds kmem.lock, if it is in use.
+static void
+buddyfree(char *v, int order)
+{
+  uint pa, bpa;
+
+  pa = V2P(v);
+  for(; order < MAXORDER; order++){
+    bpa = pa ^ (PGSIZE << order);
+    if(bpa >= PHYSTOP || pgorder[bpa/PGSIZE] != (order | PGFREE))
+      break;
+    buddyremove((struct run*)P2V(bpa), order);
+    pa &= ~(PGSIZE << order);
+  }
+  buddypush((struct run*)P2V(pa), order);
+}
+
+// Take a block of the given order, splitting a larger one
+// if need be.  Returns 0 if there is none.
+// Caller holds kmem.lock, if it is in use.
+static char*
+buddyalloc(int order)
+{
+  struct run *r;
+  int o;
+
+  for(o = order; o <= MAXORDER && kmem.freelist[o] == 0; o++)
+    ;
+  if(o > MAXORDER)
+    return 0;
+  r = kmem.freelist[o];
+  buddyremove(r, o);
+  // Give back the upper halves until the block is small enough.
+  while(o > order){
+    o--;
+    buddypush((struct run*)((char*)r + (PGSIZE << o)), o);
+  }
+  return (char*)r;
 }
+
+// Add a reference to page v, which came from kalloc().
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
+  __sync_fetch_and_add(&pgref[V2P(v)/PGSIZE], 1);
+}
+
+// Number of references to page v.
+int
+krefcnt(char *v)
+{
+  return pgref[V2P(v)/PGSIZE];
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last.
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct run *r, *last;
+  struct kcache *c;
+  int i;
+  ushort ref;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
+  if((ref = __sync_sub_and_fetch(&pgref[V2P(v)/PGSIZE], 1)) != 0){
+    if(ref == 0xffff)
+      panic("kfree: not allocated");
+    return;
+  }
 
+#ifdef KALLOCDEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
+
+  // Until kinit2() only one CPU runs, and cpuid() may not work yet.
+  if(!kmem.use_lock){
+    buddyfree(v, 0);
+    return;
+  }
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  pushcli();
+  c = &kcache[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->n > NKCACHE){
+    // Hand the oldest half back in one batch.
+    for(last = c->freelist, i = 1; i < NKCACHE/2; i++)
+      last = last->next;
+    r = last->next;
+    last->next = 0;
+    c->n = NKCACHE/2;
+    acquire(&kmem.lock);
+    for(; r; r = last){
+      last = r->next;
+      buddyfree((char*)r, 0);
+    }
     release(&kmem.lock);
+  }
+  release(&c->lock);
+  popcli();
+}
+
+// Move up to NKCACHE/2 pages from the buddy lists to c.
+// Caller holds c->lock.
+static void
+krefill(struct kcache *c)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(c->n < NKCACHE/2 && (r = (struct run*)buddyalloc(0)) != 0){
+    r->next = c->freelist;
+    c->freelist = r;
+    c->n++;
+  }
+  release(&kmem.lock);
+}
+
+// Take one page from c, or return 0 if it is empty.
+// Caller holds c->lock.
+static struct run*
+kpop(struct kcache *c)
+{
+  struct run *r;
+
+  if((r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->n--;
+  }
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +284,186 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
+  int i;
+
+  if(!kmem.use_lock){
+    if((r = (struct run*)buddyalloc(0)) != 0)
+      pgref[V2P(r)/PGSIZE] = 1;
+    return (char*)r;
+  }
+
+  pushcli();
+  c = &kcache[cpuid()];
+  acquire(&c->lock);
+  if(c->freelist == 0)
+    krefill(c);
+  r = kpop(c);
+  release(&c->lock);
+
+  // Out of memory, except perhaps in other CPUs' caches.
+  for(i = 0; r == 0 && i < NCPU; i++){
+    if(&kcache[i] == c)
+      continue;
+    acquire(&kcache[i].lock);
+    r = kpop(&kcache[i]);
+    release(&kcache[i].lock);
+  }
+  popcli();
+
+  // Or in the zero pool.
+  if(r == 0){
+    acquire(&zpool.lock);
+    if((r = zpool.freelist) != 0){
+      zpool.freelist = r->next;
+      zpool.n--;
+    }
+    release(&zpool.lock);
+  }
+  if(r)
+    pgref[V2P(r)/PGSIZE] = 1;
+  return (char*)r;
+}
+
+// Return every page in the per-CPU caches to the buddy
+// lists, so that they can merge into larger blocks.
+static void
+kdrain(void)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    acquire(&kcache[i].lock);
+    acquire(&kmem.lock);
+    while((r = kpop(&kcache[i])) != 0)
+      buddyfree((char*)r, 0);
+    release(&kmem.lock);
+    release(&kcache[i].lock);
+  }
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size.  Returns 0 if no such block is free.  The block
+// has one reference, counted on its first page.
+char*
+kalloc_order(int order)
+{
+  char *v;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+  if(!kmem.use_lock)
+    v = buddyalloc(order);
+  else {
+    acquire(&kmem.lock);
+    v = buddyalloc(order);
+    release(&kmem.lock);
+  }
+  if(v == 0 && kmem.use_lock){
+    // Cached single pages may be what keeps blocks apart.
+    kdrain();
+    acquire(&kmem.lock);
+    v = buddyalloc(order);
+    release(&kmem.lock);
+  }
+  if(v)
+    pgref[V2P(v)/PGSIZE] = 1;
+  return v;
+}
+
+// Drop a reference to a block returned by kalloc_order(order),
+// freeing it if that was the last.  kincref() adds references.
+void
+kfree_order(char *v, int order)
+{
+  ushort ref;
+
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(order < 0 || order > MAXORDER || (uint)v % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+  if((ref = __sync_sub_and_fetch(&pgref[V2P(v)/PGSIZE], 1)) != 0){
+    if(ref == 0xffff)
+      panic("kfree_order: not allocated");
+    return;
+  }
+
+#ifdef KALLOCDEBUG
+  memset(v, 1, PGSIZE << order);
+#endif
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  buddyfree(v, order);
   if(kmem.use_lock)
     release(&kmem.lock);
+}
+
+// Report the free blocks of each order and the pages
+// held in the per-CPU caches and the zero pool.
+void
+buddyinfo(struct buddyinfo *bi)
+{
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i <= MAXORDER; i++)
+    bi->nfree[i] = kmem.nfree[i];
+  bi->npage = kmem.npage;
+  release(&kmem.lock);
+  bi->ncached = 0;
+  for(i = 0; i < NCPU; i++)
+    bi->ncached += kcache[i].n;
+  bi->nzero = zpool.n;
+}
+
+// Allocate one page of zeroed memory, from the pool kept
+// by kzero() when it can.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  r = 0;
+  if(kmem.use_lock){
+    acquire(&zpool.lock);
+    if((r = zpool.freelist) != 0){
+      zpool.freelist = r->next;
+      zpool.n--;
+    }
+    release(&zpool.lock);
+  }
+  if(r){
+    r->next = 0;
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
   return (char*)r;
 }
 
+// Zero one page into the pool, unless it is full.  The
+// scheduler calls this when it finds nothing to run, so the
+// pool fills only with time no process wants.
+void
+kzero(void)
+{
+  struct run *r;
+
+  if(!kmem.use_lock || zpool.n >= NZPOOL)
+    return;
+  if((r = (struct run*)kalloc()) == 0)
+    return;
+  memset(r, 0, PGSIZE);
+  acquire(&zpool.lock);
+  r->next = zpool.freelist;
+  zpool.freelist = r;
+  zpool.n++;
+  release(&zpool.lock);
+}
@@ -0,0 +1,143 @@
+#include "types.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "param.h"
+#include "memlayout.h"
+#include "user.h"
+#include "lockstat.h"
+
+// Print the locks with the most spinning, as recorded by a kernel
+// built with LOCKSTAT=1.  Locks sharing a name (every pipe, every
+// buffer's sleep lock) are merged into one line.
+//
+//   lockstat [n]   show the worst n locks (default 10)
+//   lockstat -r    reset all counters
+
+struct sym {
+    uint addr;
+    char *name;
+};
+
+struct sym *syms;
+int nsyms;
+
+// Load the "address name" lines of kernel.sym, if it is
+// present in the file system, for symbolizing call stacks.
+void loadsyms(void) {
+    struct stat st;
+    char *buf, *p, *q;
+    int fd, n, i;
+    uint addr;
+
+    if((fd = open("kernel.sym", O_RDONLY)) < 0)
+        return;
+    if(fstat(fd, &st) < 0 || (buf = malloc(st.size + 1)) == 0) {
+        close(fd);
+        return;
+    }
+    for(n = 0; n < st.size; n += i)
+        if((i = read(fd, buf + n, st.size - n)) <= 0)
+            break;
+    close(fd);
+    buf[n] = 0;
+
+    for(i = 0, p = buf; *p; p++)
+        if(*p == '\n')
+            i++;
+    if((syms = malloc((i + 1) * sizeof(struct sym))) == 0)
+        return;
+
+    for(p = buf; *p; p = q) {
+        for(q = p; *q && *q != '\n'; q++)
+            ;
+        if(*q)
+            *q++ = 0;
+        for(addr = 0; ; p++) {
+            if(*p >= '0' && *p <= '9')
+                addr = addr*16 + *p - '0';
+            else if(*p >= 'a' && *p <= 'f')
+                addr = addr*16 + *p - 'a' + 10;
+            else
+                break;
+        }
+        if(*p != ' ' || addr < KERNLINK)
+            continue;
+        syms[nsyms].addr = addr;
+        syms[nsyms].name = p + 1;
+        nsyms++;
+    }
+}
+
+void printpc(uint pc) {
+    struct sym *s, *best;
+
+    best = 0;
+    for(s = syms; s < syms + nsyms; s++)
+        if(s->addr <= pc && (best == 0 || s->addr > best->addr))
+            best = s;
+    if(best)
+        printf(1, "    %x %s+0x%x\n", pc, best->name, pc - best->addr);
+    else
+        printf(1, "    %x\n", pc);
+}
+
+int main(int argc, char *argv[]) {
+    struct lockstat *ls, *a, *b, t;
+    int n, i, j, top;
+
+    if(argc > 1 && strcmp(argv[1], "-r") == 0) {
+        if(lockstat(0, 0, 1) < 0)
+            printf(2, "lockstat: kernel built without LOCKSTAT=1\n");
+        exit();
+    }
+    top = argc > 1 ? atoi(argv[1]) : 10;
+
+    if((ls = malloc(NLOCKSTAT * sizeof(struct lockstat))) == 0) {
+        printf(2, "lockstat: out of memory\n");
+        exit();
+    }
+    if((n = lockstat(ls, NLOCKSTAT, 0)) < 0) {
+        printf(2, "lockstat: kernel built without LOCKSTAT=1\n");
+        exit();
+    }
+
+    // Merge locks of the same name, keeping the longest hold's stack.
+    for(i = 0; i < n; i++) {
+        a = &ls[i];
+        for(j = i + 1; j < n; ) {
+            b = &ls[j];
+            if(strcmp(a->name, b->name) != 0) {
+                j++;
+                continue;
+            }
+            a->nacquire += b->nacquire;
+            a->ncontended += b->ncontended;
+            a->spincycles += b->spincycles;
+            if(b->maxhold > a->maxhold) {
+                a->maxhold = b->maxhold;
+                memmove(a->pcs, b->pcs, sizeof(a->pcs));
+            }
+            ls[j] = ls[--n];
+        }
+    }
+
+    // Sort by time spent spinning, worst first.
+    for(i = 0; i < n; i++)
+        for(j = i + 1; j < n; j++)
+            if(ls[j].spincycles > ls[i].spincycles) {
+                t = ls[i];
+                ls[i] = ls[j];
+                ls[j] = t;
+            }
+
+    loadsyms();
+    printf(1, "%s %s %s %s %s\n", "name", "acquires", "contended", "spin(Kcyc)", "maxhold(Kcyc)");
+    for(i = 0; i < n && i < top; i++) {
+        a = &ls[i];
+        printf(1, "%s %d %d %d %d\n", a->name, a->nacquire, a->ncontended,
+               (uint)(a->spincycles >> 10), (uint)(a->maxhold >> 10));
+        for(j = 0; j < 10 && a->pcs[j]; j++)
+            printpc(a->pcs[j]);
+    }
+    exit();
+}
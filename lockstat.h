@@ -0,0 +1,10 @@
+// Per-lock contention statistics, as returned by the
+// lockstat system call on kernels built with LOCKSTAT=1.
+struct lockstat {
+  char name[16];     // Name of lock.
+  uint nacquire;     // Number of acquisitions.
+  uint ncontended;   // Acquisitions that had to spin.
+  uint64 spincycles; // Total cycles spent spinning.
+  uint64 maxhold;    // Longest hold time, in cycles.
+  uint pcs[10];      // Call stack of the longest hold.
+};
@@ -0,0 +1,58 @@
+#include "types.h"
+#include "user.h"
+
+// Lock torture benchmark.  Runs nproc processes that all hammer
+// one kernel spinlock for nticks clock ticks and reports the total
+// throughput and how evenly the acquisitions were spread.
+//
+//   locktorture [nproc] [nticks]
+
+int main(int argc, char *argv[]) {
+    int nproc, nticks, i, n, fd[2];
+    int total, min, max;
+
+    nproc = argc > 1 ? atoi(argv[1]) : 8;
+    nticks = argc > 2 ? atoi(argv[2]) : 100;
+    if(nproc < 1 || nticks < 1) {
+        printf(2, "usage: locktorture [nproc] [nticks]\n");
+        exit();
+    }
+    if(pipe(fd) < 0) {
+        printf(2, "locktorture: pipe failed\n");
+        exit();
+    }
+
+    for(i = 0; i < nproc; i++) {
+        int pid = fork();
+        if(pid < 0) {
+            printf(2, "locktorture: fork failed\n");
+            break;
+        }
+        if(pid == 0) {
+            close(fd[0]);
+            n = locktorture(nticks);
+            write(fd[1], &n, sizeof(n));
+            exit();
+        }
+    }
+    close(fd[1]);
+
+    total = 0;
+    min = max = -1;
+    for(i = 0; read(fd[0], &n, sizeof(n)) == sizeof(n); i++) {
+        printf(1, "proc %d: %d acquisitions\n", i, n);
+        total += n;
+        if(min < 0 || n < min)
+            min = n;
+        if(n > max)
+            max = n;
+    }
+    while(wait() >= 0)
+        ;
+
+    if(i == 0)
+        exit();
+    printf(1, "total %d acquisitions in %d ticks, %d per tick\n", total, nticks, total / nticks);
+    printf(1, "fairness: min %d max %d, min/max %d%%\n", min, max, max ? min * 100 / max : 0);
+    exit();
+}
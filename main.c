@@ -3,6 +3,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 
@@ -26,8 +27,14 @@ int main(void) {
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
+  vdsoinit();      // shared time page
+  profinit();      // sampling profiler
+  futexinit();     // futex wait queues
   binit();         // buffer cache
   fileinit();      // file table
+  iinit();         // inode cache
+  pipeinit();      // pipe cache
+  shminit();       // shared memory segments
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
@@ -6,6 +6,9 @@
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
+#define MMAPBASE 0x40000000         // mmap() region; the heap stays below
+#define USTACKTOP 0x3FFFE000        // User stack grows down from here;
+                                    // the vDSO pages are above (vdso.h)
 #define KERNLINK (KERNBASE+EXTMEM)  // Address where kernel is linked
 
 #define V2P(a) (((uint) (a)) - KERNBASE)
@@ -0,0 +1,25 @@
+// Memory use, as returned by the memstat system call.
+// Counts are in pages unless noted.
+struct memstat {
+  uint npage;      // Pages managed by the allocator
+  uint nfree;      // Free, with the per-CPU caches and zero pool
+  uint npgtab;     // Page directories and page tables
+  uint nkstack;    // Kernel stacks
+  uint nslab;      // Slab caches: inodes, files, pipes, ...
+  uint npipe;      // Of those, pipe buffers
+  uint nbuf;       // Buffer cache blocks, outside the allocator
+  uint nswap;      // Swap slots, a page each
+  uint nswapfree;  // Free swap slots
+};
+
+// One process's memory use, also from memstat.
+struct procmem {
+  int pid;
+  char name[16];
+  uint sz;         // Bytes of text, data and heap
+  uint stack;      // Bytes reserved for the stack
+  uint rss;        // User pages in memory
+  uint swap;       // User pages swapped out
+  uint pgtab;      // Page table pages, with the directory
+  int thread;      // Shares its parent's page table
+};
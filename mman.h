@@ -0,0 +1,9 @@
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+#define MAP_HUGE      0x40000  // 4MB pages; anonymous mappings only
+
+#define MAP_FAILED    ((void*)-1)
@@ -0,0 +1,387 @@
+// Memory mappings: mmap() and munmap().
+//
+// A mapping only reserves a range of addresses between
+// MMAPBASE and KERNBASE; pagefault() fills each page the
+// first time it is touched, from the file or with zeroes.
+// Writes to a private mapping stay in the process.  Pages
+// of a shared mapping are shared with children made by
+// fork(), and the dirty ones are written back to the file
+// by munmap(), exec() and exit().  There is no page cache,
+// so processes that map a file independently each get
+// their own copy of its pages.
+//
+// Shared memory segments (see shm.c) are attached as shared
+// mappings whose pages come from the segment.  Shared anonymous
+// mappings get a segment of their own, so that children made by
+// fork() fault in its pages as they touch them, like attachers
+// of a segment, rather than fork() allocating them all.
+//
+// Anonymous mappings made with MAP_HUGE use 4MB pages, saving
+// page tables and TLB entries for big regions.  They are placed
+// and sized in whole 4MB pages, and can only be unmapped in
+// whole pages too.
+//
+// Each process has its own table of mappings.  Threads
+// get copies of it, and since a change would have to be
+// made in every thread, and unmapping would need TLB
+// shootdowns, mmap() and munmap() refuse to run in a
+// process whose address space is shared.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "mman.h"
+
+// Return p's mapping containing va, or 0.
+struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Return a mapping of p overlapping [addr, addr+len), or 0.
+static struct vma*
+overlap(struct proc *p, uint addr, uint len)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr && addr < v->addr + v->len && v->addr < addr + len)
+      return v;
+  return 0;
+}
+
+// Choose where to put a mapping of len bytes, aligned to align:
+// at addr if that range is free, otherwise as high as possible.
+// len must be a multiple of align.  Returns 0 if there is no room.
+static uint
+place(struct proc *p, uint addr, uint len, uint align)
+{
+  struct vma *v;
+
+  if(addr % align == 0 && addr >= MMAPBASE && addr <= KERNBASE - len &&
+     overlap(p, addr, len) == 0)
+    return addr;
+  addr = KERNBASE - len;
+  while((v = overlap(p, addr, len)) != 0){
+    if(v->addr < MMAPBASE + len)
+      return 0;
+    addr = (v->addr - len) & ~(align - 1);
+  }
+  return addr;
+}
+
+// Take another reference to what v maps.
+static void
+vmaref(struct vma *v)
+{
+  if(v->f)
+    filedup(v->f);
+  if(v->shm)
+    shmdup(v->shm);
+}
+
+// Drop v's reference to what it maps.
+static void
+vmaunref(struct vma *v)
+{
+  if(v->f)
+    fileclose(v->f);
+  if(v->shm)
+    shmclose(v->shm);
+  v->f = 0;
+  v->shm = 0;
+}
+
+// Add a mapping of len bytes to the current process, near addr
+// if possible, taking a reference to f or s.  Returns its
+// address or -1.
+int
+addvma(uint addr, uint len, int prot, int flags, struct file *f, uint off,
+       struct shm *s)
+{
+  struct proc *curproc = myproc();
+  struct spinlock *lk;
+  struct vma *v, *fv;
+
+  lk = vmlock(curproc->pgdir);
+  acquire(lk);
+  if(vmshared(curproc))
+    goto bad;
+  fv = 0;
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++)
+    if(v->addr == 0){
+      fv = v;
+      break;
+    }
+  if(fv == 0 ||
+     (addr = place(curproc, addr, len,
+                   (flags & MAP_HUGE) ? HUGEPGSIZE : PGSIZE)) == 0)
+    goto bad;
+  fv->addr = addr;
+  fv->len = len;
+  fv->prot = prot;
+  fv->flags = flags;
+  fv->f = f;
+  fv->off = off;
+  fv->shm = s;
+  vmaref(fv);
+  release(lk);
+  return addr;
+
+bad:
+  release(lk);
+  return -1;
+}
+
+// Map len bytes of f starting at off, or of zeroes if flags
+// has MAP_ANONYMOUS, into the current process, near addr if
+// possible.  Returns the address of the mapping or -1.
+int
+mmap(uint addr, uint len, int prot, int flags, struct file *f, uint off)
+{
+  struct shm *s;
+  int type, r;
+
+  type = flags & (MAP_SHARED|MAP_PRIVATE);
+  if(type != MAP_SHARED && type != MAP_PRIVATE)
+    return -1;
+  if(len == 0 || len > KERNBASE - MMAPBASE || off % PGSIZE)
+    return -1;
+  len = PGROUNDUP(len);
+  if(flags & MAP_HUGE){
+    if(!(flags & MAP_ANONYMOUS))
+      return -1;
+    len = (len + HUGEPGSIZE - 1) & ~(HUGEPGSIZE - 1);
+  }
+  if(flags & MAP_ANONYMOUS)
+    f = 0;
+  else if(f == 0 || f->type != FD_INODE || !f->readable)
+    return -1;
+  else if(type == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+  if(type == MAP_SHARED && f == 0 && !(flags & MAP_HUGE)){
+    if((s = shmanon(len)) == 0)
+      return -1;
+    r = addvma(addr, len, prot, flags, 0, 0, s);
+    shmclose(s);  // the mapping holds its own reference
+    return r;
+  }
+  return addvma(addr, len, prot, flags, f, off, 0);
+}
+
+// Write the dirty pages of p's mapping v between start and
+// end back to its file, if it is a shared file mapping.
+// Does not extend the file.
+static void
+writeback(struct proc *p, struct vma *v, uint start, uint end)
+{
+  // Keep each transaction within the log, as filewrite does.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+  struct inode *ip;
+  uint va, off, size, n, n1, i;
+  char *mem;
+
+  if(v->f == 0 || !(v->flags & MAP_SHARED) || !(v->prot & PROT_WRITE))
+    return;
+  ip = v->f->ip;
+  for(va = start; va < end; va += PGSIZE){
+    if((mem = dirtypage(p->pgdir, (char*)va)) == 0)
+      continue;
+    off = v->off + (va - v->addr);
+    ilock(ip);
+    size = ip->size;
+    iunlock(ip);
+    if(off >= size)
+      break;
+    n = size - off < PGSIZE ? size - off : PGSIZE;
+    for(i = 0; i < n; i += n1){
+      n1 = n - i < max ? n - i : max;
+      begin_op();
+      ilock(ip);
+      writei(ip, mem + i, off + i, n1);
+      iunlock(ip);
+      end_op();
+    }
+  }
+}
+
+// Remove the current process's mappings between addr and
+// addr+len, writing back dirty pages of shared file mappings.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *curproc = myproc();
+  struct spinlock *lk;
+  struct vma *v, *fv;
+  uint start, end, vend;
+  int shared;
+
+  if(addr % PGSIZE || len == 0 || addr < MMAPBASE || len > KERNBASE - addr)
+    return -1;
+  len = PGROUNDUP(len);
+
+  lk = vmlock(curproc->pgdir);
+  acquire(lk);
+  shared = vmshared(curproc);
+  release(lk);
+  if(shared)
+    return -1;
+
+  // Unmapping the middle of a mapping splits it in two.
+  // 4MB pages cannot be split.
+  fv = 0;
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++){
+    if(v->addr == 0)
+      fv = v;
+    else if((v->flags & MAP_HUGE) && addr < v->addr + v->len &&
+            v->addr < addr + len && (addr | len) % HUGEPGSIZE)
+      return -1;
+  }
+  v = overlap(curproc, addr, len);
+  if(v && addr > v->addr && addr + len < v->addr + v->len && fv == 0)
+    return -1;
+
+  while((v = overlap(curproc, addr, len)) != 0){
+    vend = v->addr + v->len;
+    start = addr > v->addr ? addr : v->addr;
+    end = addr + len < vend ? addr + len : vend;
+    writeback(curproc, v, start, end);
+    deallocuvm(curproc->pgdir, end, start);
+    if(start == v->addr && end == vend){
+      vmaunref(v);
+      v->addr = 0;
+    } else if(start == v->addr){
+      v->off += end - v->addr;
+      v->len = vend - end;
+      v->addr = end;
+    } else if(end == vend){
+      v->len = start - v->addr;
+    } else {
+      *fv = *v;
+      fv->addr = end;
+      fv->len = vend - end;
+      fv->off += end - v->addr;
+      vmaref(fv);
+      v->len = start - v->addr;
+    }
+  }
+  flushuvm();
+  return 0;
+}
+
+// Return a page holding the contents of mapping v at va,
+// or 0 if memory is short or the file cannot be read.  Called
+// by pagefault() the first time va is touched; the caller gets
+// a reference to the page.  For a MAP_HUGE mapping, the page
+// is a zeroed 4MB block from kalloc_order(HUGEORDER).
+char*
+vmapage(struct vma *v, uint va)
+{
+  struct inode *ip;
+  uint off, n;
+  char *mem;
+
+  off = v->off + (va - v->addr);
+  if(v->shm)
+    return shmpage(v->shm, off / PGSIZE);
+  if(v->flags & MAP_HUGE){
+    if((mem = kalloc_order(HUGEORDER)) != 0)
+      memset(mem, 0, HUGEPGSIZE);
+    return mem;
+  }
+  if((mem = kalloc_zeroed()) == 0 || v->f == 0)
+    return mem;
+  ip = v->f->ip;
+  ilock(ip);
+  if(off < ip->size){
+    n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+    if(readi(ip, mem, off, n) != n){
+      kfree(mem);
+      mem = 0;
+    }
+  }
+  iunlock(ip);
+  return mem;
+}
+
+// Fault in every page of p's shared file mappings, so that
+// fork() can share them with the child.  p is the current
+// process.
+int
+vmapopulate(struct proc *p)
+{
+  struct vma *v;
+  uint va;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    // The child can find shared memory segment pages itself,
+    // those of shared anonymous mappings included.
+    if(v->addr == 0 || !(v->flags & MAP_SHARED) || v->shm)
+      continue;
+    for(va = v->addr; va < v->addr + v->len; va += PGSIZE)
+      if(uva2ka(p->pgdir, (char*)va) == 0 && pagefault(va, 0) < 0)
+        return -1;
+  }
+  return 0;
+}
+
+// Map the pages of p's mappings into child page table d: the
+// same pages for shared mappings, copies (copy-on-write if cow
+// is set) for private ones.  Caller holds vmlock(p->pgdir).
+int
+vmacopy(struct proc *p, pde_t *d, int cow)
+{
+  struct vma *v;
+  int share;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0)
+      continue;
+    share = (v->flags & MAP_SHARED) != 0;
+    if(dupuvm(p->pgdir, d, v->addr, v->addr + v->len, share, cow) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Give np copies of p's mappings.
+void
+vmadup(struct proc *np, struct proc *p)
+{
+  struct vma *v, *nv;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    *nv = *v;
+    if(nv->addr)
+      vmaref(nv);
+  }
+}
+
+// Drop all of p's mappings, writing back shared file pages.
+// The pages themselves go with p's page table.
+void
+vmaclose(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0)
+      continue;
+    writeback(p, v, v->addr, v->addr + v->len);
+    vmaunref(v);
+    v->addr = 0;
+  }
+}
@@ -0,0 +1,247 @@
+#include "types.h"
+#include "fcntl.h"
+#include "mman.h"
+#include "user.h"
+
+// Exercise mmap()/munmap(): anonymous and file mappings,
+// private and shared, across fork(), a shared mapping bigger
+// than memory, system calls on mapped buffers, and 4MB pages.
+//
+//   mmaptest
+
+#define FSIZE (2*4096 + 1000)   // not a whole number of pages
+
+char *file = "mmaptest.tmp";
+char buf[FSIZE];
+
+void fail(char *what) {
+    printf(1, "mmaptest: %s failed\n", what);
+    unlink(file);
+    exit();
+}
+
+// Create file with FSIZE bytes of a known pattern.
+void mkfile(void) {
+    int fd, i;
+
+    for(i = 0; i < FSIZE; i++)
+        buf[i] = 'a' + i % 23;
+    if((fd = open(file, O_CREATE | O_RDWR)) < 0)
+        fail("create");
+    if(write(fd, buf, FSIZE) != FSIZE)
+        fail("write file");
+    close(fd);
+}
+
+// Check that file still holds the pattern, except that the
+// byte at off is c.
+void checkfile(int off, char c) {
+    int fd, i;
+
+    if((fd = open(file, O_RDONLY)) < 0)
+        fail("open");
+    if(read(fd, buf, FSIZE) != FSIZE)
+        fail("read file");
+    close(fd);
+    for(i = 0; i < FSIZE; i++)
+        if(buf[i] != (i == off ? c : 'a' + i % 23))
+            fail("file contents");
+}
+
+void anontest(void) {
+    char *p;
+    int i, n;
+
+    n = 3*4096;
+    if((p = mmap(0, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        fail("anonymous mmap");
+    for(i = 0; i < n; i++)
+        if(p[i] != 0)
+            fail("anonymous zero fill");
+    for(i = 0; i < n; i++)
+        p[i] = i;
+    for(i = 0; i < n; i++)
+        if(p[i] != (char)i)
+            fail("anonymous read back");
+    // Unmap the middle page, splitting the mapping.
+    if(munmap(p + 4096, 4096) < 0)
+        fail("partial munmap");
+    if(p[0] != 0 || p[2*4096] != (char)(2*4096))
+        fail("split mapping");
+    if(munmap(p, n) < 0)
+        fail("munmap");
+}
+
+void filetest(void) {
+    char *p;
+    int fd, i;
+
+    mkfile();
+
+    // A private mapping sees the file; writes stay private.
+    if((fd = open(file, O_RDONLY)) < 0)
+        fail("open");
+    if((p = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        fail("private mmap");
+    close(fd);
+    for(i = 0; i < FSIZE; i++)
+        if(p[i] != 'a' + i % 23)
+            fail("private contents");
+    if(p[FSIZE] != 0)
+        fail("zero past end of file");
+    p[10] = 'X';
+    if(munmap(p, FSIZE) < 0)
+        fail("munmap");
+    checkfile(-1, 0);
+
+    // A shared mapping at an offset is written back.
+    if((fd = open(file, O_RDWR)) < 0)
+        fail("open");
+    if((p = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 4096)) == MAP_FAILED)
+        fail("shared mmap");
+    close(fd);
+    if(p[0] != 'a' + 4096 % 23)
+        fail("offset contents");
+    p[5] = 'Y';
+    if(munmap(p, 4096) < 0)
+        fail("munmap");
+    checkfile(4096 + 5, 'Y');
+
+    // A read-only file cannot be mapped shared and writable.
+    mkfile();
+    if((fd = open(file, O_RDONLY)) < 0)
+        fail("open");
+    if(mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED)
+        fail("writable shared mapping of read-only file");
+
+    // System calls can read from a mapping but not write to a
+    // read-only one.
+    if((p = mmap(0, FSIZE, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        fail("read-only mmap");
+    if(read(fd, p, 10) >= 0)
+        fail("read into read-only mapping");
+    close(fd);
+    if((fd = open(file, O_RDWR)) < 0)
+        fail("open");
+    if(write(fd, p, 4096) != 4096)
+        fail("write from mapping");
+    close(fd);
+    checkfile(-1, 0);
+    munmap(p, FSIZE);
+}
+
+void forktest(void) {
+    char *shared, *private, *p;
+    int fd, pid;
+
+    mkfile();
+    if((shared = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        fail("shared anonymous mmap");
+    if((private = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        fail("private anonymous mmap");
+    if((fd = open(file, O_RDWR)) < 0)
+        fail("open");
+    if((p = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        fail("shared mmap");
+    close(fd);
+
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0) {
+        shared[0] = 'S';
+        private[0] = 'P';
+        // exit() writes back the shared file mapping.
+        p[2*4096] = 'Z';
+        exit();
+    }
+    wait();
+    if(shared[0] != 'S')
+        fail("shared anonymous mapping across fork");
+    if(private[0] != 0)
+        fail("private anonymous mapping across fork");
+    if(p[2*4096] != 'Z')
+        fail("shared file mapping across fork");
+    checkfile(2*4096, 'Z');
+    munmap(shared, 4096);
+    munmap(private, 4096);
+    munmap(p, FSIZE);
+}
+
+// A shared anonymous mapping larger than memory costs fork()
+// nothing: the child faults in only what it touches.
+void bigsharedtest(void) {
+    char *p;
+    int n, pid;
+
+    n = 256*1024*1024;
+    if((p = mmap(0, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        fail("big shared mmap");
+    p[0] = 'a';
+    if((pid = fork()) < 0)
+        fail("fork with big shared mapping");
+    if(pid == 0) {
+        if(p[0] != 'a')
+            fail("big shared mapping in child");
+        p[n/2] = 'b';
+        p[n-1] = 'c';
+        exit();
+    }
+    wait();
+    if(p[n/2] != 'b' || p[n-1] != 'c')
+        fail("big shared mapping across fork");
+    if(munmap(p, n) < 0)
+        fail("munmap");
+}
+
+void hugetest(void) {
+    char *shared, *private;
+    int n, pid;
+
+    n = 2*4096*1024;
+    if((shared = mmap(0, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_HUGE, -1, 0)) == MAP_FAILED)
+        fail("huge shared mmap");
+    if((uint)shared % (4096*1024) != 0)
+        fail("huge mapping alignment");
+    // Not a whole number of 4MB pages; rounded up.
+    if((private = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGE, -1, 0)) == MAP_FAILED)
+        fail("huge private mmap");
+    if(mmap(0, 4096, PROT_READ, MAP_PRIVATE | MAP_HUGE, 0, 0) != MAP_FAILED)
+        fail("huge file mapping");
+    if(shared[n-1] != 0 || private[4096*1024-1] != 0)
+        fail("huge zero fill");
+    shared[0] = 'a';
+    private[12345] = 'b';
+
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0) {
+        shared[n-1] = 'S';
+        private[12345] = 'P';
+        exit();
+    }
+    wait();
+    if(shared[0] != 'a' || shared[n-1] != 'S')
+        fail("huge shared mapping across fork");
+    if(private[12345] != 'b')
+        fail("huge private mapping across fork");
+    // A system call can use a buffer in a 4MB page.
+    if(pipe((int*)(shared + 4096)) < 0)
+        fail("pipe into huge page");
+    close(((int*)(shared + 4096))[0]);
+    close(((int*)(shared + 4096))[1]);
+    if(munmap(shared + 4096, 4096) >= 0)
+        fail("munmap of part of a 4MB page");
+    if(munmap(shared, n) < 0 || munmap(private, 4096*1024) < 0)
+        fail("huge munmap");
+}
+
+int main(int argc, char *argv[]) {
+    anontest();
+    filetest();
+    forktest();
+    bigsharedtest();
+    hugetest();
+    unlink(file);
+    printf(1, "mmaptest OK\n");
+    exit();
+}
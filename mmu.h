@@ -2,7 +2,9 @@
 // x86 memory management unit (MMU).
 
 // Eflags register
+#define FL_TF           0x00000100      // Trap Flag
 #define FL_IF           0x00000200      // Interrupt Enable
+#define FL_AC           0x00040000      // Alignment Check
 
 // Control Register flags
 #define CR0_PE          0x00000001      // Protection Enable
@@ -10,16 +12,24 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
 
-// various segment selectors.
+// Model-specific registers for sysenter
+#define MSR_SYSENTER_CS  0x174          // Kernel %cs; %ss is the next selector
+#define MSR_SYSENTER_ESP 0x175          // Kernel %esp
+#define MSR_SYSENTER_EIP 0x176          // Kernel entry point
+
+// various segment selectors.  sysenter and sysexit need the
+// kernel and user code and data segments in this order.
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
 #define SEG_UCODE 3  // user code
 #define SEG_UDATA 4  // user data+stack
 #define SEG_TSS   5  // this process's task state
+#define SEG_KCPU  6  // this CPU's struct cpu, in %gs
 
 // cpu->gdt[NSEGS] holds the above segments.
-#define NSEGS     6
+#define NSEGS     7
 
 #ifndef __ASSEMBLER__
 // Segment Descriptor
@@ -83,6 +93,8 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define HUGEPGSIZE      (PGSIZE*NPTENTRIES) // bytes mapped by a 4MB page
+#define HUGEORDER       10      // kalloc_order() order of a 4MB page
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
@@ -94,7 +106,12 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global: kept in the TLB across %cr3 loads
+#define PTE_COW         0x200   // Copy-on-write (software bit)
+#define PTE_SWAP        0x400   // Swapped out, to the slot in the address bits (software bit)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
@@ -2,13 +2,31 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXPATH     128  // max path name length, with its nul
+#define STACKLIMIT  (1024*1024)  // default user stack limit (bytes)
+#define MAXSTACK    (64*1024*1024)  // largest stack limit setrlimit() allows
+#define NSEG          4  // max loadable segments in a program
+#define NVMA         16  // max memory mappings per process
+#define NSHM         16  // max shared memory segments
+#define NSHMPAGE     64  // max pages in a shared memory segment
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FSSIZE       2000  // size of file system in blocks
+#define SWAPSIZE     8192  // size of swap area in blocks, after the file system
+#define SWAPBATCH      16  // max pages swapped out at once when memory is short
 
+#define NLOCKSTAT   512  // max locks tracked by lockstat
+#define NPROFSAMPLE 4096  // profiler samples buffered per CPU
+#define PROFMAXRATE  16  // max profiler samples per clock tick
+#define NQNODE        8  // max spinlocks held or awaited at once per CPU
+#define NFUTEXHASH   64  // futex wait queue buckets
+#define NVMLOCK      16  // address space lock stripes
+#define NKCACHE      64  // free pages cached per CPU by kalloc
+#define NZPOOL      256  // pre-zeroed pages kept for kalloc_zeroed
+#define MAXORDER     10  // largest kalloc_order() block is 2^MAXORDER pages
+#define NSLABMAG     16  // free objects cached per CPU by each slab cache
+#define NIHASH       64  // in-memory inode hash buckets
@@ -4,29 +4,62 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
-#include "proc.h"
 #include "spinlock.h"
-
+#include "proc.h"
+#include "mman.h"
+#include "buddy.h"
+#include "memstat.h"
+
+// Each process's p->lock protects its state, chan, killed and
+// scheduling statistics, so CPUs scheduling or waking different
+// processes do not contend.  ptable.wait_lock protects every
+// p->parent and is the condition lock for wait(); it must be
+// acquired before any p->lock.  ptable.rwlock protects the
+// identity of each slot (whether it is in use, and p->pid),
+// so that lookups and monitoring can walk the table without
+// taking any p->lock.  Writers hold p->lock first; readers must
+// not acquire a p->lock while holding ptable.rwlock.  No code
+// holds two p->locks at once.
+//
+// Threads made by clone() share their creator's pgdir.
+// vmlock(pgdir) serializes changes to an address space's size
+// and to which processes use it, so that its sz stays the same
+// in every thread and only its last user frees it.
 struct {
-    struct spinlock lock;
+    struct spinlock wait_lock;
+    struct rwlock rwlock;
+    struct spinlock vmlock[NVMLOCK];
     struct proc proc[NPROC];
 } ptable;
 
 static struct proc *initproc;
+static int reap(int, int*, int*, void**);
+static int fault(uint, int);
 
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 int q_age[5] = {10, 20, 30, 40, 50};
 
-static void wakeup1(void *chan);
+struct spinlock* vmlock(pde_t *pgdir) {
+    return &ptable.vmlock[((uint)pgdir / PGSIZE) % NVMLOCK];
+}
 
 void pinit(void) {
-    initlock(&ptable.lock, "ptable");
+    struct proc *p;
+
+    int i;
+
+    initlock(&ptable.wait_lock, "wait_lock");
+    initrwlock(&ptable.rwlock, "ptable");
+    for(i = 0; i < NVMLOCK; i++)
+        initlock(&ptable.vmlock[i], "vm");
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        initlock(&p->lock, "proc");
 }
 
 void demote_q(struct proc* p) { //Moves process to a higher queue if timeslices are utilized
-    acquire(&ptable.lock);
+    acquire(&p->lock);
     if(p->prev_q != 4) {
 #ifdef DEBUG_Y
         cprintf("Process %d has utilized timeslices %d, moving from %d to %d\n", p->pid,p->cur_q_ticks, p->prev_q, p->prev_q+1);
@@ -36,23 +69,23 @@ void demote_q(struct proc* p) { //Moves process to a higher queue if timeslices
 #endif
         p->prev_q++;
     }
-    release(&ptable.lock);
+    release(&p->lock);
 }
 
 void inc_q_ticks(struct proc* p) { //Increase ticks of current queue
-    acquire(&ptable.lock);
+    acquire(&p->lock);
     p->cur_q_ticks++;
     p->q_ticks[p->cur_q]++;
 #ifdef DEBUG_YN
     cprintf("Process %d, increased ticks %d for queue %d\n", p->pid, p->cur_q_ticks, p->cur_q);
 #endif
-    release(&ptable.lock);
+    release(&p->lock);
 }
 
 void inc_r_io_time() {
     struct proc *p;
-    acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+        acquire(&p->lock);
         if(p->state == RUNNING) {
             p->rtime++;
             //p->q_ticks[p->prev_q]++;
@@ -65,8 +98,8 @@ void inc_r_io_time() {
         if(p->state == RUNNABLE) {
             p->cur_q_waiting_time++;
         }
+        release(&p->lock);
     }
-    release(&ptable.lock);
 }
 
 // Must be called with interrupts disabled
@@ -74,36 +107,45 @@ int cpuid() {
     return mycpu()-cpus;
 }
 
+// %gs points at this CPU's struct cpu (see seginit).
 // Must be called with interrupts disabled to avoid the caller being
-// rescheduled between reading lapicid and running through the loop.
+// rescheduled onto another CPU while using the result.
 struct cpu* mycpu(void) {
-    int apicid, i;
+    struct cpu *c;
 
     if(readeflags()&FL_IF)
         panic("mycpu called with interrupts enabled\n");
-
-    apicid = lapicid();
-    // APIC IDs are not guaranteed to be contiguous. Maybe we should have
-    // a reverse map, or reserve a register to store &cpus[i].
-    for (i = 0; i < ncpu; ++i) {
-        if (cpus[i].apicid == apicid)
-            return &cpus[i];
-    }
-    panic("unknown apicid\n");
+    asm volatile("movl %%gs:%c1, %0" : "=r" (c)
+                 : "i" (__builtin_offsetof(struct cpu, self)));
+    return c;
 }
 
-// Disable interrupts so that we are not rescheduled
-// while reading proc from the cpu structure
+// A single load from %gs needs no pushcli: if the process is
+// moved to another CPU after it, cpu->proc there is the same.
 struct proc* myproc(void) {
-    struct cpu *c;
     struct proc *p;
-    pushcli();
-    c = mycpu();
-    p = c->proc;
-    popcli();
+
+    asm volatile("movl %%gs:%c1, %0" : "=r" (p)
+                 : "i" (__builtin_offsetof(struct cpu, proc)));
     return p;
 }
 
+// Return an EMBRYO or ZOMBIE slot to the UNUSED pool.
+// The caller has already released its memory.
+static void freeproc(struct proc *p) {
+    acquire(&p->lock);
+    acquirewrite(&ptable.rwlock);
+    p->pid = 0;
+    p->parent = 0;
+    p->name[0] = 0;
+    p->killed = 0;
+    p->thread = 0;
+    p->ustack = 0;
+    p->state = UNUSED;
+    releasewrite(&ptable.rwlock);
+    release(&p->lock);
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -113,24 +155,25 @@ static struct proc* allocproc(void) {
     struct proc *p;
     char *sp;
 
-    acquire(&ptable.lock);
-
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+        acquire(&p->lock);
         if(p->state == UNUSED)
             goto found;
-
-    release(&ptable.lock);
+        release(&p->lock);
+    }
     return 0;
 
 found:
+    acquirewrite(&ptable.rwlock);
     p->state = EMBRYO;
-    p->pid = nextpid++;
+    p->pid = __sync_fetch_and_add(&nextpid, 1);
+    releasewrite(&ptable.rwlock);
 
-    release(&ptable.lock);
+    release(&p->lock);
 
     // Allocate kernel stack.
     if((p->kstack = kalloc()) == 0){
-        p->state = UNUSED;
+        freeproc(p);
         return 0;
     }
     sp = p->kstack + KSTACKSIZE;
@@ -181,10 +224,12 @@ void userinit(void) {
     p = allocproc();
 
     initproc = p;
-    if((p->pgdir = setupkvm()) == 0)
+    if((p->pgdir = setupkvm()) == 0 || vdsomap(p->pgdir, p->pid) < 0)
         panic("userinit: out of memory?");
     inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
     p->sz = PGSIZE;
+    p->stacklimit = STACKLIMIT;
+    p->stackbase = USTACKTOP - STACKLIMIT;
     memset(p->tf, 0, sizeof(*p->tf));
     p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
     p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -201,7 +246,7 @@ void userinit(void) {
     // run this process. the acquire forces the above
     // writes to be visible, and the lock is also needed
     // because the assignment might not be atomic.
-    acquire(&ptable.lock);
+    acquire(&p->lock);
 
     p->state = RUNNABLE;
 
@@ -211,33 +256,209 @@ void userinit(void) {
     p->q_join_time = ticks;
 #endif
 
-    release(&ptable.lock);
+    release(&p->lock);
 }
 
-// Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
-int growproc(int n) {
-    uint sz;
-    struct proc *curproc = myproc();
+// Does another process share p's page table?
+// Caller holds vmlock(p->pgdir).
+int vmshared(struct proc *p) {
+    struct proc *q;
 
-    sz = curproc->sz;
+    for(q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+        if(q != p && q->pgdir == p->pgdir)
+            return 1;
+    return 0;
+}
+
+// Point p at page table pgdir, or at none when p is being
+// freed.  Returns p's old page table if no other thread
+// uses it any more, for the caller to free once it is no
+// longer running on it; otherwise returns 0.
+pde_t* swappgdir(struct proc *p, pde_t *pgdir) {
+    struct spinlock *lk;
+    struct proc *q;
+    pde_t *old;
+
+    old = p->pgdir;
+    lk = vmlock(old);
+    acquire(lk);
+    p->pgdir = pgdir;
+    for(q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+        if(q->pgdir == old)
+            break;
+    release(lk);
+    return q == &ptable.proc[NPROC] ? old : 0;
+}
+
+// Grow current process's memory by n bytes, in every thread
+// sharing its address space.
+// Return the old size on success, -1 on failure.
+int growproc(int n) {
+    uint oldsz, sz;
+    struct proc *p, *curproc = myproc();
+    struct spinlock *lk;
+    int shared;
+
+    lk = vmlock(curproc->pgdir);
+    acquire(lk);
+    oldsz = sz = curproc->sz;
+    shared = vmshared(curproc);
     if(n > 0){
-        if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-            return -1;
+        // Only reserve the address space; pagefault() maps
+        // zeroed pages as they are first touched.  Leave the
+        // guard page below the stack unmapped.
+        if(sz + n > curproc->stackbase - PGSIZE || sz + n < sz)
+            goto bad;
+        sz += n;
     } else if(n < 0){
+        // Other CPUs running our threads may still have the
+        // pages in their TLBs, and xv6 cannot shoot them down.
+        if(shared)
+            goto bad;
         if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-            return -1;
+            goto bad;
     }
-    curproc->sz = sz;
-    switchuvm(curproc);
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if(p->pgdir == curproc->pgdir)
+            p->sz = sz;
+    release(lk);
+    if(n < 0)
+        flushuvm();
+    return oldsz;
+
+bad:
+    release(lk);
+    return -1;
+}
+
+// Return the end of the part of p's memory that holds user
+// address addr: sz if addr is below it, USTACKTOP if addr is in
+// the stack region, or 0 if addr is in neither.
+uint memend(struct proc *p, uint addr) {
+    if(addr < p->sz)
+        return p->sz;
+    if(addr >= p->stackbase && addr < USTACKTOP)
+        return USTACKTOP;
     return 0;
 }
 
+// Handle a page fault at user address va in the current
+// process, taken either in user code or while the kernel
+// touches user memory: read program and mapped file pages
+// from their files and swapped-out pages from swap, map
+// untouched heap and stack pages and break copy-on-write.  If memory is
+// short, swap other processes' pages out and try again.
+// Returns -1 if the access is not allowed or memory cannot be
+// found.  Reading a file or swap may sleep, so faults on such
+// pages must not happen with spinlocks held.
+int pagefault(uint va, int write) {
+    int r;
+
+    while((r = fault(va, write)) == -2 && swapout(SWAPBATCH) > 0)
+        ;
+    return r < 0 ? -1 : 0;
+}
+
+// One attempt at pagefault().  Returns -1 if the access is not
+// allowed, -2 if memory is short.
+static int fault(uint va, int write) {
+    struct proc *curproc = myproc();
+    struct spinlock *lk;
+    struct segment *s;
+    struct vma *v;
+    char *mem;
+    int r, perm;
+
+    va = PGROUNDDOWN(va);
+    if((r = swapin(curproc->pgdir, va)) < 0)
+        return r;
+    mem = 0;
+    perm = PTE_W|PTE_U;
+    if((v = findvma(curproc, va)) != 0){
+        if(!(v->prot & PROT_READ) || (write && !(v->prot & PROT_WRITE)))
+            return -1;
+        if(!(v->prot & PROT_WRITE))
+            perm = PTE_U;
+        if(v->flags & MAP_HUGE)
+            perm |= PTE_PS;
+        if(uva2ka(curproc->pgdir, (char*)va) == 0 && (mem = vmapage(v, va)) == 0)
+            return -2;
+    }
+    for(s = curproc->seg; v == 0 && s < curproc->seg + curproc->nseg; s++){
+        if(va < s->va || va >= s->va + s->memsz)
+            continue;
+        if(uva2ka(curproc->pgdir, (char*)va) == 0){
+            if((mem = kalloc_zeroed()) == 0)
+                return -2;
+            if(loadseg(curproc->exe, s, va, mem) < 0){
+                kfree(mem);
+                return -1;
+            }
+        }
+        break;
+    }
+
+    lk = vmlock(curproc->pgdir);
+    acquire(lk);
+    r = -1;
+    if(memend(curproc, va) || v)
+        r = vmfault(curproc->pgdir, va, write, mem, perm);
+    else if(mem)
+        kfree(mem);
+    release(lk);
+    return r;
+}
+
+// The clock hand for swapout(): the process, and the address
+// in it, where the next scan starts.  swapout() runs one scan
+// at a time.
+static struct proc *swaphand = ptable.proc;
+static uint swaphandva;
+
+// Find up to n pages to swap out, for swapout(), moving the
+// clock hand at most twice around the process table: enough
+// to clear the accessed bits and come back to the pages not
+// used since.  Only swappable processes that are not running,
+// and whose page table no thread shares, give up pages.
+// Returns how many were found, in page[] and slot[].
+int swapscan(char **page, uint *slot, int n) {
+    struct proc *p;
+    struct spinlock *lk;
+    char *mem;
+    int k, steps, full;
+
+    k = 0;
+    full = 0;
+    for(steps = 0; k < n && !full && steps <= 2*NPROC; steps++){
+        p = swaphand;
+        acquire(&p->lock);
+        if((p->state == RUNNABLE || p->state == SLEEPING) && p->swappable){
+            lk = vmlock(p->pgdir);
+            acquire(lk);
+            while(k < n && !vmshared(p)){
+                if((mem = vmevict(p->pgdir, &swaphandva, USTACKTOP, &slot[k])) == 0){
+                    full = swaphandva < USTACKTOP;
+                    break;
+                }
+                page[k++] = mem;
+            }
+            release(lk);
+        }
+        release(&p->lock);
+        if(k < n && !full){
+            if(++swaphand == &ptable.proc[NPROC])
+                swaphand = ptable.proc;
+            swaphandva = 0;
+        }
+    }
+    return k;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
 int fork(void) {
-    int i, pid;
+    int i, pid, cow;
     struct proc *np;
     struct proc *curproc = myproc();
 
@@ -246,15 +467,42 @@ int fork(void) {
         return -1;
     }
 
-    // Copy process state from proc.
-    if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+    // Copy process state from proc.  The lock keeps other
+    // threads from resizing the address space meanwhile.
+    // Memory is shared copy-on-write unless other threads use
+    // it: their CPUs might keep writing through stale TLB
+    // entries after the pages are made read-only.  Pages of
+    // shared mappings must exist before they can be shared.
+    // The stack is copied along with the memory below sz.
+    // If memory is short, swap out others' pages and retry.
+retry:
+    if(vmapopulate(curproc) < 0)
+        np->pgdir = 0;
+    else {
+        acquire(vmlock(curproc->pgdir));
+        cow = !vmshared(curproc);
+        if(cow)
+            np->pgdir = cowuvm(curproc->pgdir, USTACKTOP);
+        else
+            np->pgdir = copyuvm(curproc->pgdir, USTACKTOP);
+        if(np->pgdir && (vmacopy(curproc, np->pgdir, cow) < 0 ||
+                         vdsomap(np->pgdir, np->pid) < 0)){
+            freevm(np->pgdir);
+            np->pgdir = 0;
+        }
+        np->sz = curproc->sz;
+        np->stackbase = curproc->stackbase;
+        np->stacklimit = curproc->stacklimit;
+        release(vmlock(curproc->pgdir));
+    }
+    if(np->pgdir == 0 && swapout(SWAPBATCH) > 0)
+        goto retry;
+    if(np->pgdir == 0){
         kfree(np->kstack);
         np->kstack = 0;
-        np->state = UNUSED;
+        freeproc(np);
         return -1;
     }
-    np->sz = curproc->sz;
-    np->parent = curproc;
     *np->tf = *curproc->tf;
 
     // Clear %eax so that fork returns 0 in the child.
@@ -264,12 +512,21 @@ int fork(void) {
         if(curproc->ofile[i])
             np->ofile[i] = filedup(curproc->ofile[i]);
     np->cwd = idup(curproc->cwd);
+    if(curproc->exe)
+        np->exe = idup(curproc->exe);
+    memmove(np->seg, curproc->seg, sizeof(np->seg));
+    np->nseg = curproc->nseg;
+    vmadup(np, curproc);
 
     safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
     pid = np->pid;
 
-    acquire(&ptable.lock);
+    acquire(&ptable.wait_lock);
+    np->parent = curproc;
+    release(&ptable.wait_lock);
+
+    acquire(&np->lock);
 
     np->state = RUNNABLE;
     /*
@@ -280,7 +537,148 @@ np->q_join_time = ticks;
 #endif
 */
 
-    release(&ptable.lock);
+    release(&np->lock);
+
+    return pid;
+}
+
+// Start the program at path with argv in a new child process,
+// building its address space straight from the executable
+// instead of copying the caller's as fork() would.  The child
+// gets duplicates of the caller's open files or, if fds is not
+// 0, only fds[0], fds[1] and fds[2] as its descriptors 0, 1
+// and 2 (-1 leaves one closed).
+int spawn(char *path, char **argv, int *fds) {
+    int i, fd, pid;
+    struct image im;
+    struct proc *np;
+    struct proc *curproc = myproc();
+
+    for(i = 0; fds && i < 3; i++)
+        if(fds[i] != -1 && (fds[i] < 0 || fds[i] >= NOFILE || curproc->ofile[fds[i]] == 0))
+            return -1;
+
+    // Allocate process.
+    if((np = allocproc()) == 0){
+        return -1;
+    }
+    if(loadimage(path, argv, &im) < 0){
+        kfree(np->kstack);
+        np->kstack = 0;
+        freeproc(np);
+        return -1;
+    }
+    vdsosetpid(im.pgdir, np->pid);
+    np->pgdir = im.pgdir;
+    np->sz = im.sz;
+    np->stackbase = im.stackbase;
+    np->stacklimit = curproc->stacklimit;
+    np->exe = im.exe;
+    memmove(np->seg, im.seg, sizeof(im.seg));
+    np->nseg = im.nseg;
+    safestrcpy(np->name, im.name, sizeof(np->name));
+
+    *np->tf = *curproc->tf;
+    np->tf->eip = im.entry;  // main
+    np->tf->esp = im.sp;
+
+    for(i = 0; i < NOFILE; i++){
+        fd = fds ? (i < 3 ? fds[i] : -1) : i;
+        if(fd >= 0 && curproc->ofile[fd])
+            np->ofile[i] = filedup(curproc->ofile[fd]);
+    }
+    np->cwd = idup(curproc->cwd);
+
+    pid = np->pid;
+
+    acquire(&ptable.wait_lock);
+    np->parent = curproc;
+    release(&ptable.wait_lock);
+
+    acquire(&np->lock);
+    np->state = RUNNABLE;
+    release(&np->lock);
+
+    return pid;
+}
+
+// Create a thread running fn(arg) on the one-page user stack
+// whose lowest address is stack.  The thread shares the
+// caller's address space and starts with duplicates of its
+// open files; it becomes a child of the caller, to be reaped
+// with join().
+int clone(void (*fn)(void*), void *stack, void *arg) {
+    int i, pid;
+    uint sp, ustack[2];
+    struct proc *np;
+    struct proc *curproc = myproc();
+
+    if((uint)stack % sizeof(uint) != 0)
+        return -1;
+
+    // copyout() below cannot read program pages from the
+    // executable, so fault in the words it writes first.
+    sp = (uint)stack + PGSIZE - sizeof(ustack);
+    if(pagefault(sp, 1) < 0 || pagefault(sp + sizeof(ustack) - 1, 1) < 0)
+        return -1;
+
+    // Allocate process.
+    if((np = allocproc()) == 0){
+        return -1;
+    }
+
+    // Start at fn(arg), with a fake return PC; the thread
+    // must call exit() rather than return.
+    ustack[0] = 0xffffffff;
+    ustack[1] = (uint)arg;
+
+    // Threads must not share copy-on-write pages: breaking one
+    // would leave stale TLB entries on the other threads' CPUs.
+    acquire(vmlock(curproc->pgdir));
+    if((uint)stack + PGSIZE > curproc->sz || (uint)stack + PGSIZE < (uint)stack ||
+       uncowuvm(curproc->pgdir, KERNBASE) < 0 ||
+       copyout(curproc->pgdir, sp, ustack, sizeof(ustack)) < 0){
+        release(vmlock(curproc->pgdir));
+        kfree(np->kstack);
+        np->kstack = 0;
+        freeproc(np);
+        return -1;
+    }
+    // getpid() cannot read the pid from the shared vDSO page.
+    vdsosetpid(curproc->pgdir, 0);
+    np->pgdir = curproc->pgdir;
+    np->sz = curproc->sz;
+    np->stackbase = curproc->stackbase;
+    np->stacklimit = curproc->stacklimit;
+    release(vmlock(curproc->pgdir));
+
+    *np->tf = *curproc->tf;
+    np->tf->esp = sp;
+    np->tf->eip = (uint)fn;
+    np->ustack = stack;
+
+    for(i = 0; i < NOFILE; i++)
+        if(curproc->ofile[i])
+            np->ofile[i] = filedup(curproc->ofile[i]);
+    np->cwd = idup(curproc->cwd);
+    if(curproc->exe)
+        np->exe = idup(curproc->exe);
+    memmove(np->seg, curproc->seg, sizeof(np->seg));
+    np->nseg = curproc->nseg;
+    vmadup(np, curproc);
+
+    safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+    pid = np->pid;
+
+    acquire(&ptable.wait_lock);
+    np->parent = curproc;
+    np->thread = 1;
+    release(&ptable.wait_lock);
+
+    acquire(&np->lock);
+    np->state = RUNNABLE;
+    release(&np->lock);
 
     return pid;
 }
@@ -304,28 +702,42 @@ void exit(void) {
         }
     }
 
+    vmaclose(curproc);
+
     begin_op();
     iput(curproc->cwd);
+    if(curproc->exe)
+        iput(curproc->exe);
     end_op();
     curproc->cwd = 0;
+    curproc->exe = 0;
+    curproc->nseg = 0;
 
-    acquire(&ptable.lock);
-
-    // Parent might be sleeping in wait().
-    wakeup1(curproc->parent);
+    acquire(&ptable.wait_lock);
 
     // Pass abandoned children to init.
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
         if(p->parent == curproc){
+            // init reaps orphaned threads with wait().
             p->parent = initproc;
-            if(p->state == ZOMBIE)
-                wakeup1(initproc);
+            p->thread = 0;
+            wakeup(initproc);
         }
     }
 
-    // Jump into the scheduler, never to return.
+    // Parent might be sleeping in wait().
+    wakeup(curproc->parent);
+
+    acquire(&curproc->lock);
+
     curproc->state = ZOMBIE;
     curproc->etime = ticks;
+
+    // The parent cannot look at us until wait_lock is released,
+    // and cannot free us until the scheduler releases curproc->lock.
+    release(&ptable.wait_lock);
+
+    // Jump into the scheduler, never to return.
     sched();
     panic("zombie exit");
 }
@@ -333,74 +745,55 @@ void exit(void) {
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int wait(void) {
-    struct proc *p;
-    int havekids, pid;
-    struct proc *curproc = myproc();
-
-    acquire(&ptable.lock);
-    for(;;){
-        // Scan through table looking for exited children.
-        havekids = 0;
-        for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-            if(p->parent != curproc)
-                continue;
-            havekids = 1;
-            if(p->state == ZOMBIE){
-                // Found one.
-                pid = p->pid;
-                kfree(p->kstack);
-                p->kstack = 0;
-                freevm(p->pgdir);
-                /*
-#ifdef MLFQ //Remove process from the queue as it is waiting
-p->cur_q = -1;
-#ifdef DEBUG_Y
-cprintf("Process %d has relinquised CPU\n", p->pid);
-#endif
-#endif
-*/
-                p->pid = 0;
-                p->parent = 0;
-                p->name[0] = 0;
-                p->killed = 0;
-                p->state = UNUSED;
-                release(&ptable.lock);
-                return pid;
-            }
-        }
+    return reap(0, 0, 0, 0);
+}
 
-        // No point waiting if we don't have any children.
-        if(!havekids || curproc->killed){
-            release(&ptable.lock);
-            return -1;
-        }
+// Like wait(), but also report how long the child spent
+// waiting for and running on a CPU.
+int waitx(int* wtime,int* rtime) {
+    return reap(0, wtime, rtime, 0);
+}
 
-        // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-        sleep(curproc, &ptable.lock);  //DOC: wait-sleep
-    }
+// Wait for a thread made by clone() to exit and return its
+// pid, storing the stack that was passed to clone() in *stack.
+// Return -1 if this process has no child threads.
+int join(void **stack) {
+    return reap(1, 0, 0, stack);
 }
 
-int waitx(int* wtime,int* rtime) {
+// Wait for a child process, or a child thread if thread is
+// set, to exit and free it.  Results are stored through any
+// non-null pointers, which may point to user memory.
+static int reap(int thread, int* wtime, int* rtime, void **stack) {
     struct proc *p;
-    int havekids, pid;
+    int havekids, pid, w, r;
+    void *s;
+    pde_t *pgdir;
     struct proc *curproc = myproc();
 
-    acquire(&ptable.lock);
+    acquire(&ptable.wait_lock);
     for(;;){
         // Scan through table looking for exited children.
         havekids = 0;
         for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-            if(p->parent != curproc)
+            if(p->parent != curproc || p->thread != thread)
                 continue;
             havekids = 1;
+            // Once exit() has set ZOMBIE, p->lock is held until the
+            // child is off its CPU, so acquiring it here makes it
+            // safe to free the child's kernel stack.
+            acquire(&p->lock);
             if(p->state == ZOMBIE){
                 // Found one.
                 pid = p->pid;
-                *wtime = (p->etime - p->ctime - p->rtime - p->iotime);
-                *rtime = p->rtime;
+                w = p->etime - p->ctime - p->rtime - p->iotime;
+                r = p->rtime;
+                s = p->ustack;
+                release(&p->lock);
                 kfree(p->kstack);
                 p->kstack = 0;
-                freevm(p->pgdir);
+                if((pgdir = swappgdir(p, 0)) != 0)
+                    freevm(pgdir);
                 /*
 #ifdef MLFQ //Remove process from the queue as it is waiting
 p->cur_q = -1;
@@ -409,24 +802,32 @@ cprintf("Process %d has relinquised CPU\n", p->pid);
 #endif
 #endif
 */
-                p->pid = 0;
-                p->parent = 0;
-                p->name[0] = 0;
-                p->killed = 0;
-                p->state = UNUSED;
-                release(&ptable.lock);
+                freeproc(p);
+                release(&ptable.wait_lock);
+                // Store to user memory only once no locks are held.
+                if(wtime)
+                    *wtime = w;
+                if(rtime)
+                    *rtime = r;
+                if(stack)
+                    *stack = s;
                 return pid;
             }
+            release(&p->lock);
         }
 
         // No point waiting if we don't have any children.
         if(!havekids || curproc->killed){
-            release(&ptable.lock);
+            release(&ptable.wait_lock);
             return -1;
         }
 
-        // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-        sleep(curproc, &ptable.lock);  //DOC: wait-sleep
+        // Wait for children to exit.  (See wakeup call in exit.)
+        // User memory is only touched after wait_lock is
+        // released, so the pages may be swapped out meanwhile.
+        curproc->swappable = 1;
+        sleep(curproc, &ptable.wait_lock);  //DOC: wait-sleep
+        curproc->swappable = 0;
     }
 }
 
@@ -437,63 +838,153 @@ int set_priority(int new_priority, int pid){
         return -1;
     int old_priority;
     struct proc *p;
-    acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->pid == pid)
+        acquire(&p->lock);
+        if(p->pid == pid && p->state != UNUSED)
             break;
+        release(&p->lock);
     }
+    if(p == &ptable.proc[NPROC])
+        return -1;
     old_priority = p->priority;
     p->priority = new_priority;
-    release(&ptable.lock);
+    release(&p->lock);
     if(new_priority < old_priority)
         yield();
     return old_priority;
 }
 
+// Print the process table.  Each slot is copied out under
+// ptable.rwlock and printed afterwards, so neither the scheduler
+// nor fork and wait have to wait for the console.
 int ps_func() {
     int num_proc=0;
     struct proc *p;
-    acquire(&ptable.lock);
+    struct proc_ps ps;
+    struct spinlock *lk;
+    pde_t *pgdir;
+    uint pgtab;
 #ifdef MLFQ
     //cprintf("PID  Priority  State  r_time  w_time  n_run  cur_q  q0  q1  q2  q3  q4\n");
-    cprintf("%s %s   %s   %s %s %s %s  %s  %s   %s   %s   %s\n", "PID", "Priority", "State", "r_time", "w_time", "n_run", "cur_q", "q0", "q1", "q2", "q3", "q4");
+    cprintf("%s %s   %s   %s %s %s %s  %s  %s   %s   %s   %s   %s  %s\n", "PID", "Priority", "State", "r_time", "w_time", "n_run", "cur_q", "q0", "q1", "q2", "q3", "q4", "rss", "swap");
 #else
-    //cprintf("PID  Priority  State  r_time  w_time  n_run\n");
-    cprintf("%s %s %s %s %s %s\n", "PID", "Priority", "State", "r_time", "w_time", "n_run");
+    //cprintf("PID  Priority  State  r_time  w_time  n_run  rss  swap\n");
+    cprintf("%s %s %s %s %s %s %s %s\n", "PID", "Priority", "State", "r_time", "w_time", "n_run", "rss", "swap");
 #endif
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state != UNUSED) {
-            cprintf("%d     ",p->pid);
-            cprintf("%d     ",p->priority);
-            if(p->state == RUNNING)
+        acquireread(&ptable.rwlock);
+        ps.state = p->state;
+        ps.pid = p->pid;
+        ps.priority = p->priority;
+        ps.rtime = p->rtime;
+        ps.wtime = p->cur_q_waiting_time;
+        ps.n_run = p->n_run;
+        ps.cur_q = p->prev_q;
+        memmove(ps.q_ticks, p->q_ticks, sizeof(ps.q_ticks));
+        pgdir = p->pgdir;
+        releaseread(&ptable.rwlock);
+        // Pages in memory and swapped out.  Holding vmlock(pgdir)
+        // keeps pgdir from being freed, if p still uses it.
+        ps.rss = ps.swap = 0;
+        if(pgdir){
+            lk = vmlock(pgdir);
+            acquire(lk);
+            if(p->pgdir == pgdir)
+                vmcount(pgdir, &ps.rss, &ps.swap, &pgtab);
+            release(lk);
+        }
+        if(ps.state != UNUSED) {
+            cprintf("%d     ",ps.pid);
+            cprintf("%d     ",ps.priority);
+            if(ps.state == RUNNING)
                 cprintf(" %s    ", "RUNNING");
-            if(p->state == EMBRYO)
+            if(ps.state == EMBRYO)
                 cprintf(" %s     ", "EMBRYO");
-            if(p->state == SLEEPING)
+            if(ps.state == SLEEPING)
                 cprintf(" %s   ", "SLEEPING");
-            if(p->state == RUNNABLE)
+            if(ps.state == RUNNABLE)
                 cprintf(" %s   ", "RUNNABLE");
-            if(p->state == ZOMBIE)
+            if(ps.state == ZOMBIE)
                 cprintf(" %s   ", "ZOMBIE");
-            cprintf("  %d   ",p->rtime);
-            cprintf("  %d   ",p->cur_q_waiting_time);
-            cprintf("  %d   ",p->n_run);
+            cprintf("  %d   ",ps.rtime);
+            cprintf("  %d   ",ps.wtime);
+            cprintf("  %d   ",ps.n_run);
 #ifdef MLFQ
-            cprintf("%d   ",p->prev_q);
-            cprintf(" %d   ",p->q_ticks[0]);
-            cprintf(" %d   ",p->q_ticks[1]);
-            cprintf(" %d   ",p->q_ticks[2]);
-            cprintf(" %d   ",p->q_ticks[3]);
-            cprintf(" %d",p->q_ticks[4]);
+            cprintf("%d   ",ps.cur_q);
+            cprintf(" %d   ",ps.q_ticks[0]);
+            cprintf(" %d   ",ps.q_ticks[1]);
+            cprintf(" %d   ",ps.q_ticks[2]);
+            cprintf(" %d   ",ps.q_ticks[3]);
+            cprintf(" %d   ",ps.q_ticks[4]);
 #endif
+            cprintf("  %d   ",ps.rss);
+            cprintf("  %d",ps.swap);
             cprintf("\n");
             num_proc++;
         }
     }
-    release(&ptable.lock);
     return num_proc;
 }
 
+// Fill in ms with the system's memory use and pm with that of
+// up to n processes.  pm is user memory, so it is only written
+// with no locks held.  Returns the number of processes in pm.
+int memstat(struct memstat *ms, struct procmem *pm, int n) {
+    struct buddyinfo bi;
+    struct procmem m;
+    struct proc *p;
+    struct spinlock *lk;
+    pde_t *pgdir;
+    enum procstate state;
+    int i, k;
+
+    buddyinfo(&bi);
+    ms->npage = bi.npage;
+    ms->nfree = bi.ncached + bi.nzero;
+    for(i = 0; i <= MAXORDER; i++)
+        ms->nfree += bi.nfree[i] << i;
+    ms->npgtab = pgtabpages();
+    ms->nslab = slabpages(0);
+    ms->npipe = pipepages();
+    ms->nbuf = NBUF;
+    swapstat(&ms->nswap, &ms->nswapfree);
+
+    ms->nkstack = 0;
+    k = 0;
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+        acquireread(&ptable.rwlock);
+        state = p->state;
+        if(p->kstack)
+            ms->nkstack++;
+        memset(&m, 0, sizeof(m));
+        m.pid = p->pid;
+        safestrcpy(m.name, p->name, sizeof(m.name));
+        m.sz = p->sz;
+        m.stack = USTACKTOP - p->stackbase;
+        m.thread = p->thread;
+        pgdir = p->pgdir;
+        releaseread(&ptable.rwlock);
+        if(state == UNUSED || state == EMBRYO || pgdir == 0 || k >= n)
+            continue;
+        // As in ps_func, vmlock(pgdir) keeps pgdir alive.
+        lk = vmlock(pgdir);
+        acquire(lk);
+        if(p->pgdir == pgdir)
+            vmcount(pgdir, &m.rss, &m.swap, &m.pgtab);
+        release(lk);
+        pm[k++] = m;
+    }
+    return k;
+}
+
+// The scheduler found nothing to run: stop using the last
+// process's page table, and spend the time zeroing a page for
+// kalloc_zeroed().
+static void idle(void) {
+    idlekvm();
+    kzero();
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -502,6 +993,9 @@ int ps_func() {
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
+// The last process's page table stays loaded after it stops
+// running, in case it or another of its threads runs next;
+// idle() switches away from it when there is nothing to run.
 void scheduler(void) {
     struct proc *p;
     struct cpu *c = mycpu();
@@ -512,29 +1006,33 @@ void scheduler(void) {
         // Enable interrupts on this processor.
         sti();
         // Loop over process table looking for process to run.
-        acquire(&ptable.lock);
+        int ran = 0;
         for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-            if(p->state != RUNNABLE)
-                continue;
-            // Switch to chosen process.  It is the process's job
-            // to release ptable.lock and then reacquire it
-            // before jumping back to us.
-            c->proc = p;
-            p->n_run++;
-            switchuvm(p);
-            p->state = RUNNING;
-            swtch(&(c->scheduler), p->context);
-            switchkvm();
-            // Process is done running for now.
-            // It should have changed its p->state before coming back.
-            c->proc = 0;
+            acquire(&p->lock);
+            if(p->state == RUNNABLE){
+                ran = 1;
+                // Switch to chosen process.  It is the process's job
+                // to release p->lock and then reacquire it
+                // before jumping back to us.
+                c->proc = p;
+                p->n_run++;
+                switchuvm(p);
+                p->state = RUNNING;
+                swtch(&(c->scheduler), p->context);
+                // Process is done running for now.
+                // It should have changed its p->state before coming back.
+                c->proc = 0;
+            }
+            release(&p->lock);
         }
-        release(&ptable.lock);
+        if(!ran)
+            idle();
 #elif FCFS
         // Enable interrupts on this processor.
         sti();
         // Loop over process table looking for process to run.
-        acquire(&ptable.lock);
+        // The scan takes no locks; the choice is re-checked
+        // under the chosen process's lock.
         int minval = ticks+75;
         struct proc *p1=0;
         for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
@@ -546,11 +1044,16 @@ void scheduler(void) {
             }
         }
         if (p1 == 0) {
-            release(&ptable.lock);
+            idle();
+            continue;
+        }
+        acquire(&p1->lock);
+        if(p1->state != RUNNABLE) {
+            release(&p1->lock);
             continue;
         }
         // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
+        // to release p1->lock and then reacquire it
         // before jumping back to us.
         c->proc = p1;
         p1->n_run++;
@@ -558,16 +1061,16 @@ void scheduler(void) {
         switchuvm(p1);
         p1->state = RUNNING;
         swtch(&(c->scheduler), p1->context);
-        switchkvm();
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         c->proc = 0;
-        release(&ptable.lock);
+        release(&p1->lock);
 #elif PBS
         // Enable interrupts on this processor.
         sti();
         // Loop over process table looking for process to run.
-        acquire(&ptable.lock);
+        // The scans take no locks; each choice is re-checked
+        // under the chosen process's lock.
         int minpri = 101;
         struct proc *p1;
         for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
@@ -578,25 +1081,30 @@ void scheduler(void) {
             }
         }
         if (minpri == 101) {
-            release(&ptable.lock);
+            idle();
             continue;
         }
         int br_flag=0;
         for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
             if(p->state != RUNNABLE || p->priority != minpri)
                 continue;
+            acquire(&p->lock);
+            if(p->state != RUNNABLE || p->priority != minpri) {
+                release(&p->lock);
+                continue;
+            }
             // Switch to chosen process.  It is the process's job
-            // to release ptable.lock and then reacquire it
+            // to release p->lock and then reacquire it
             // before jumping back to us.
             c->proc = p;
             p->n_run++;
             switchuvm(p);
             p->state = RUNNING;
             swtch(&(c->scheduler), p->context);
-            switchkvm();
             // Process is done running for now.
             // It should have changed its p->state before coming back.
             c->proc = 0;
+            release(&p->lock);
             br_flag=0;
             for(p1 = ptable.proc; p1 < &ptable.proc[NPROC]; p1++) {
                 if(p1->state != RUNNABLE)
@@ -610,15 +1118,14 @@ void scheduler(void) {
                 break;
             }
         }
-        release(&ptable.lock);
 #elif MLFQ
         // Enable interrupts on this processor.
         sti();
         // Loop over process table looking for process to run.
         struct proc *p1 = 0;
         int found_proc = 0;
-        acquire(&ptable.lock);
         for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+            acquire(&p->lock);
             if(p->state == RUNNABLE && (p->cur_q_waiting_time >= q_age[p->cur_q]) && p->cur_q > 0) { //If the process has aged in current queue
 #ifdef DEBUG_Y
                 cprintf("Process %d has aged, value - %d, age for queue %d - %d, moving to %d\n", p->pid, ticks - p->q_join_time, p->prev_q, q_age[p->prev_q], p->prev_q-1);
@@ -632,7 +1139,10 @@ void scheduler(void) {
                 p->cur_q--; //Decrease the queue
                 p->prev_q--;
             }
+            release(&p->lock);
         }
+        // The queue scan takes no locks; the choice is re-checked
+        // under the chosen process's lock.
         for(int it=0; it<=4; it++) {
             int min_join_time = -1;
             if(found_proc == 0) {
@@ -660,7 +1170,12 @@ void scheduler(void) {
             }
         }
         if (found_proc == 0) {
-            release(&ptable.lock);
+            idle();
+            continue;
+        }
+        acquire(&p1->lock);
+        if(p1->state != RUNNABLE) {
+            release(&p1->lock);
             continue;
         }
 #ifdef DEBUG_Y
@@ -672,29 +1187,28 @@ void scheduler(void) {
         //p1->q_ticks[p1->cur_q]++;
         p1->cur_q = -1; //Remove from queue
         // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
+        // to release p1->lock and then reacquire it
         // before jumping back to us.
         c->proc = p1;
         switchuvm(p1);
         p1->state = RUNNING;
         swtch(&(c->scheduler), p1->context);
-        switchkvm();
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         c->proc = 0;
         //TODO: RUNNABLE || SLEEPING 
         if(p1->state == RUNNABLE || p1->state == SLEEPING) {
-            p->cur_q_ticks=0; //Ticks in current queue in this round
-            p->cur_q_waiting_time = 0;
-            p->q_join_time = ticks; //Join time
+            p1->cur_q_ticks=0; //Ticks in current queue in this round
+            p1->cur_q_waiting_time = 0;
+            p1->q_join_time = ticks; //Join time
             p1->cur_q = p1->prev_q;
         }
-        release(&ptable.lock);
+        release(&p1->lock);
 #endif
     }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
+// Enter scheduler.  Must hold only p->lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
@@ -705,8 +1219,8 @@ void sched(void) {
     int intena;
     struct proc *p = myproc();
 
-    if(!holding(&ptable.lock))
-        panic("sched ptable.lock");
+    if(!holding(&p->lock))
+        panic("sched p->lock");
     if(mycpu()->ncli != 1)
         panic("sched locks");
     if(p->state == RUNNING)
@@ -720,26 +1234,40 @@ void sched(void) {
 
 // Give up the CPU for one scheduling round.
 void yield(void) {
-    acquire(&ptable.lock);  //DOC: yieldlock
-    myproc()->state = RUNNABLE;
+    struct proc *p = myproc();
+
+    acquire(&p->lock);  //DOC: yieldlock
+    p->state = RUNNABLE;
     sched();
-    release(&ptable.lock);
+    release(&p->lock);
+}
+
+// Give up the CPU at a timer interrupt.  If the interrupt came
+// from user code, the process's pages may be swapped out while
+// it waits to run again.
+void preempt(int user) {
+    struct proc *p = myproc();
+
+    p->swappable = user;
+    yield();
+    p->swappable = 0;
 }
 
 // A fork child's very first scheduling by scheduler()
 // will swtch here.  "Return" to user space.
 void forkret(void) {
     static int first = 1;
-    // Still holding ptable.lock from scheduler.
-    release(&ptable.lock);
+    // Still holding p->lock from scheduler.
+    release(&myproc()->lock);
 
     if (first) {
         // Some initialization functions must be run in the context
         // of a regular process (e.g., they call sleep), and thus cannot
         // be run from main().
         first = 0;
-        iinit(ROOTDEV);
+        fsinit(ROOTDEV);
         initlog(ROOTDEV);
+        swapinit(ROOTDEV);
     }
 
     // Return to "caller", actually trapret (see allocproc).
@@ -756,14 +1284,14 @@ void sleep(void *chan, struct spinlock *lk) {
     if(lk == 0)
         panic("sleep without lk");
 
-    // Must acquire ptable.lock in order to
+    // Must acquire p->lock in order to
     // change p->state and then call sched.
-    // Once we hold ptable.lock, we can be
+    // Once we hold p->lock, we can be
     // guaranteed that we won't miss any wakeup
-    // (wakeup runs with ptable.lock locked),
+    // (wakeup locks p->lock before checking p->state),
     // so it's okay to release lk.
-    if(lk != &ptable.lock){  //DOC: sleeplock0
-        acquire(&ptable.lock);  //DOC: sleeplock1
+    if(lk != &p->lock){  //DOC: sleeplock0
+        acquire(&p->lock);  //DOC: sleeplock1
         release(lk);
     }
     // Go to sleep.
@@ -776,19 +1304,22 @@ void sleep(void *chan, struct spinlock *lk) {
     p->chan = 0;
 
     // Reacquire original lock.
-    if(lk != &ptable.lock){  //DOC: sleeplock2
-        release(&ptable.lock);
+    if(lk != &p->lock){  //DOC: sleeplock2
+        release(&p->lock);
         acquire(lk);
     }
 }
 
 //PAGEBREAK!
 // Wake up all processes sleeping on chan.
-// The ptable lock must be held.
-static void wakeup1(void *chan) {
-    struct proc *p;
+// Must be called without any p->lock held.
+void wakeup(void *chan) {
+    struct proc *p, *curproc = myproc();
 
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+        if(p == curproc)
+            continue;
+        acquire(&p->lock);
         if(p->state == SLEEPING && p->chan == chan) {
             p->state = RUNNABLE;
 #ifdef MLFQ //Re-add the process back to its previous queue as it is woken up now
@@ -798,13 +1329,8 @@ static void wakeup1(void *chan) {
             p->cur_q = p->prev_q;
 #endif
         }
-}
-
-// Wake up all processes sleeping on chan.
-void wakeup(void *chan) {
-    acquire(&ptable.lock);
-    wakeup1(chan);
-    release(&ptable.lock);
+        release(&p->lock);
+    }
 }
 
 // Kill the process with the given pid.
@@ -813,32 +1339,43 @@ void wakeup(void *chan) {
 int kill(int pid) {
     struct proc *p;
 
-    acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->pid == pid){
-            p->killed = 1;
-            // Wake process from sleep if necessary.
-            if(p->state == SLEEPING) {
-                p->state = RUNNABLE;
+    // Find the slot without holding up the scheduler.
+    acquireread(&ptable.rwlock);
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if(p->pid == pid && p->state != UNUSED)
+            break;
+    releaseread(&ptable.rwlock);
+    if(p == &ptable.proc[NPROC])
+        return -1;
+
+    acquire(&p->lock);
+    // The process may have been reaped since.
+    if(p->pid != pid || p->state == UNUSED){
+        release(&p->lock);
+        return -1;
+    }
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    if(p->state == SLEEPING) {
+        p->state = RUNNABLE;
 #ifdef MLFQ //Re-add the process back to its previous queue as it is woken up now
-                p->q_join_time = ticks;
-                p->cur_q_ticks = 0;
-                p->cur_q_waiting_time = 0;
-                p->cur_q = p->prev_q;
+        p->q_join_time = ticks;
+        p->cur_q_ticks = 0;
+        p->cur_q_waiting_time = 0;
+        p->cur_q = p->prev_q;
 #endif
-            }
-            release(&ptable.lock);
-            return 0;
-        }
     }
-    release(&ptable.lock);
-    return -1;
+    release(&p->lock);
+    return 0;
 }
 
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
-// No lock to avoid wedging a stuck machine further.
+// Only takes ptable.rwlock, one slot at a time, so it neither
+// waits for nor holds up the scheduler.  A sleeping process's
+// stack is only walked under its p->lock, which keeps wakeup()
+// from letting it run meanwhile.
 void procdump(void) {
     static char *states[] = {
         [UNUSED]    "unused",
@@ -848,24 +1385,35 @@ void procdump(void) {
         [RUNNING]   "run   ",
         [ZOMBIE]    "zombie"
     };
-    int i;
+    int i, pid;
     struct proc *p;
-    char *state;
+    enum procstate st;
+    char *state, name[16];
     uint pc[10];
 
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state == UNUSED)
+        acquireread(&ptable.rwlock);
+        st = p->state;
+        pid = p->pid;
+        memmove(name, p->name, sizeof(name));
+        releaseread(&ptable.rwlock);
+        pc[0] = 0;
+        if(st == SLEEPING){
+            acquire(&p->lock);
+            if(p->state == SLEEPING && p->pid == pid)
+                getcallerpcs((uint*)p->context->ebp+2, pc);
+            release(&p->lock);
+        }
+        if(st == UNUSED)
             continue;
-        if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-            state = states[p->state];
+        if(st >= 0 && st < NELEM(states) && states[st])
+            state = states[st];
         else
             state = "???";
-        cprintf("%d %s %s", p->pid, state, p->name);
-        if(p->state == SLEEPING){
-            getcallerpcs((uint*)p->context->ebp+2, pc);
-            for(i=0; i<10 && pc[i] != 0; i++)
-                cprintf(" %p", pc[i]);
-        }
+        name[sizeof(name)-1] = 0;
+        cprintf("%d %s %s", pid, state, name);
+        for(i=0; i<10 && pc[i] != 0; i++)
+            cprintf(" %p", pc[i]);
         cprintf("\n");
     }
 }
@@ -1,13 +1,19 @@
 // Per-CPU state
 struct cpu {
+    struct cpu *self;            // This struct, for mycpu() to load through %gs
+    struct proc *proc;           // The process running on this cpu or null
     uchar apicid;                // Local APIC ID
     struct context *scheduler;   // swtch() here to enter scheduler
     struct taskstate ts;         // Used by x86 to find stack for interrupt
+    uint sysstack[8];            // sysenter's entry stack (see idtinit)
     struct segdesc gdt[NSEGS];   // x86 global descriptor table
     volatile uint started;       // Has the CPU started?
     int ncli;                    // Depth of pushcli nesting.
     int intena;                  // Were interrupts enabled before pushcli?
-    struct proc *proc;           // The process running on this cpu or null
+    pde_t *volatile pgdir;       // Page table in %cr3 (see switchuvm)
+    volatile int tlbstale;       // pgdir changed since it was loaded here
+    int profrate;                // Timer interrupts per tick (see profile.c)
+    int profsub;                 // Timer interrupts since the last tick
 };
 #define AGE 31
 
@@ -35,20 +41,65 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A loadable segment of the running program.  Its pages are
+// read from the executable when first touched (see pagefault).
+struct segment {
+    uint va;                     // Start address, page-aligned
+    uint off;                    // File offset of va
+    uint filesz;                 // Bytes from the file; the rest is zeroed
+    uint memsz;                  // Bytes of memory
+};
+
+// A program loaded by loadimage(), for exec() or spawn()
+// to give to a process.
+struct image {
+    pde_t *pgdir;
+    uint sz;
+    uint entry;                  // Initial eip
+    uint sp;                     // Initial esp, below argv
+    uint stackbase;              // Bottom of the stack region
+    struct inode *exe;
+    struct segment seg[NSEG];
+    int nseg;
+    char name[16];
+};
+
+// A memory mapping made by mmap().  Its pages are read from
+// f, or zeroed, when first touched (see pagefault).
+struct vma {
+    uint addr;                   // Start, page-aligned; 0 if unused
+    uint len;                    // Bytes, a multiple of PGSIZE
+    int prot;                    // PROT_READ, PROT_WRITE
+    int flags;                   // MAP_SHARED or MAP_PRIVATE, MAP_ANONYMOUS
+    struct file *f;              // Mapped file, or 0 if anonymous
+    uint off;                    // File or segment offset of addr
+    struct shm *shm;             // Shared memory segment, or 0
+};
+
 // Per-process state
 struct proc {
+    struct spinlock lock;        // Protects state, chan, killed and scheduling stats
     uint sz;                     // Size of process memory (bytes)
+    uint stackbase;              // Bottom of the stack region (see below)
+    uint stacklimit;             // Stack region size for the next exec()
     pde_t* pgdir;                // Page table
     char *kstack;                // Bottom of kernel stack for this process
     enum procstate state;        // Process state
     int pid;                     // Process ID
-    struct proc *parent;         // Parent process
+    struct proc *parent;         // Parent process (protected by wait_lock)
     struct trapframe *tf;        // Trap frame for current syscall
     struct context *context;     // swtch() here to run process
     void *chan;                  // If non-zero, sleeping on chan
     int killed;                  // If non-zero, have been killed
+    int swappable;               // Pages may be swapped out while not running (see swap.c)
+    int thread;                  // Shares parent's pgdir; reaped by join() (wait_lock)
+    void *ustack;                // User stack passed to clone()
     struct file *ofile[NOFILE];  // Open files
     struct inode *cwd;           // Current directory
+    struct inode *exe;           // Executable, for paging in seg
+    struct segment seg[NSEG];    // Program text and data
+    int nseg;                    // Number of entries in seg
+    struct vma vma[NVMA];        // Memory mappings
     char name[16];               // Process name (debugging)
     int ctime;
     int etime;
@@ -73,13 +124,21 @@ struct proc_ps {
     int ctime;
     int etime;
     int iotime;
+    int wtime;
     int n_run;
     int cur_q;
     int q_ticks[5];
+    uint rss;                    // User pages in memory
+    uint swap;                   // User pages swapped out
 };
 
-// Process memory is laid out contiguously, low addresses first:
+// Process memory is laid out low addresses first:
 //   text
 //   original data and bss
-//   fixed-size stack
-//   expandable heap
+//   expandable heap, up to sz
+//   ...
+//   guard page
+//   stack region, stacklimit bytes from stackbase to USTACKTOP,
+//     its pages mapped as the stack grows down into them
+//   vDSO pages, read-only (see vdso.h)
+//   memory mappings, from MMAPBASE
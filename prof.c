@@ -0,0 +1,81 @@
+#include "types.h"
+#include "param.h"
+#include "user.h"
+#include "prof.h"
+
+// Control the kernel's timer-interrupt profiler.
+//
+//   prof start [rate]     start sampling, rate samples per tick
+//   prof stop             stop sampling
+//   prof dump             print and discard the buffered samples
+//   prof run cmd [args]   start, run cmd, stop and dump
+//
+// Samples are printed one per line as
+//   prof <cpu> <pid> <k|u> <eip> <name>
+// for prof.py on the host to symbolize.
+
+#define NSAMPLE 256
+
+void dump(void) {
+    struct profsample *s, *buf;
+    int n;
+
+    if((buf = malloc(NSAMPLE * sizeof(struct profsample))) == 0) {
+        printf(2, "prof: out of memory\n");
+        return;
+    }
+    while((n = profread(buf, NSAMPLE)) > 0) {
+        for(s = buf; s < buf + n; s++)
+            printf(1, "prof %d %d %c %x %s\n", s->cpu, s->pid,
+                   s->user ? 'u' : 'k', s->eip, s->name[0] ? s->name : "-");
+    }
+    free(buf);
+}
+
+void stop(void) {
+    int dropped;
+
+    dropped = profctl(0, 0);
+    if(dropped > 0)
+        printf(2, "prof: %d samples dropped\n", dropped);
+}
+
+int main(int argc, char *argv[]) {
+    int rate, pid, w;
+
+    if(argc < 2) {
+        printf(2, "usage: prof start [rate] | stop | dump | run cmd [args]\n");
+        exit();
+    }
+
+    if(strcmp(argv[1], "start") == 0) {
+        rate = argc > 2 ? atoi(argv[2]) : 1;
+        if(profctl(1, rate) < 0)
+            printf(2, "prof: bad rate %d (1-%d)\n", rate, PROFMAXRATE);
+    } else if(strcmp(argv[1], "stop") == 0) {
+        stop();
+    } else if(strcmp(argv[1], "dump") == 0) {
+        dump();
+    } else if(strcmp(argv[1], "run") == 0 && argc > 2) {
+        if(profctl(1, 1) < 0) {
+            printf(2, "prof: cannot start profiler\n");
+            exit();
+        }
+        pid = fork();
+        if(pid < 0) {
+            printf(2, "prof: fork failed\n");
+        } else if(pid == 0) {
+            exec(argv[2], argv + 2);
+            printf(2, "prof: exec %s failed\n", argv[2]);
+            exit();
+        } else {
+            while((w = wait()) >= 0 && w != pid)
+                ;
+        }
+        stop();
+        dump();
+    } else {
+        printf(2, "prof: unknown command %s\n", argv[1]);
+    }
+    exit();
+}
@@ -0,0 +1,9 @@
+// One sample taken by the timer-interrupt profiler,
+// as returned by the profread system call.
+struct profsample {
+  uint eip;          // Interrupted instruction
+  ushort pid;        // Process running, or 0 for the scheduler
+  uchar cpu;         // CPU that took the sample
+  uchar user;        // Was the CPU in user mode?
+  char name[8];      // Process name, truncated
+};
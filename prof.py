@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# Symbolize the samples printed by the xv6 `prof` tool and print
+# flat profiles.  Save the emulator's console output to a file,
+# then run this from the build directory (where kernel.sym and the
+# per-program *.sym files are):
+#
+#   python3 prof.py console.txt [top]
+
+import bisect
+import glob
+import os
+import sys
+
+KERNLINK = 0x80100000
+
+
+def loadsyms(path):
+    syms = []
+    for line in open(path):
+        parts = line.split()
+        if len(parts) != 2:
+            continue
+        addr = int(parts[0], 16)
+        # Skip source file names and, in the kernel, absolute symbols.
+        if parts[1].endswith((".c", ".S")):
+            continue
+        if path.endswith("kernel.sym") and addr < KERNLINK:
+            continue
+        syms.append((addr, parts[1]))
+    syms.sort()
+    return [a for a, _ in syms], [n for _, n in syms]
+
+
+def lookup(table, eip):
+    addrs, names = table
+    i = bisect.bisect_right(addrs, eip) - 1
+    if i < 0:
+        return "0x%x" % eip
+    return names[i]
+
+
+def usersyms(name, cache):
+    # Samples carry the process name truncated to 8 bytes;
+    # match it against the start of the *.sym file names.
+    if name not in cache:
+        cache[name] = None
+        for path in sorted(glob.glob("*.sym")):
+            base = os.path.basename(path)[:-4]
+            if base != "kernel" and base.startswith(name):
+                cache[name] = loadsyms(path)
+                break
+    return cache[name]
+
+
+def report(title, counts, total, top):
+    print("%s (%d samples)" % (title, sum(counts.values())))
+    for name, n in sorted(counts.items(), key=lambda kv: -kv[1])[:top]:
+        print("  %6.2f%%  %6d  %s" % (100.0 * n / total, n, name))
+    print()
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: prof.py console.txt [top]")
+        sys.exit(1)
+    top = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+
+    kernel = loadsyms("kernel.sym")
+    cache = {}
+    kcounts = {}
+    ucounts = {}
+    percpu = {}
+    total = 0
+
+    for line in open(sys.argv[1], errors="replace"):
+        parts = line.split()
+        if len(parts) != 6 or parts[0] != "prof":
+            continue
+        cpu, pid, mode, eip, name = parts[1], parts[2], parts[3], int(parts[4], 16), parts[5]
+        total += 1
+        percpu[cpu] = percpu.get(cpu, 0) + 1
+        if mode == "k":
+            sym = lookup(kernel, eip)
+            kcounts[sym] = kcounts.get(sym, 0) + 1
+        else:
+            table = usersyms(name, cache)
+            sym = lookup(table, eip) if table else "0x%x" % eip
+            key = "%s:%s" % (name, sym)
+            ucounts[key] = ucounts.get(key, 0) + 1
+
+    if total == 0:
+        print("no samples found")
+        return
+
+    ktotal = sum(kcounts.values())
+    print("%d samples, %.2f%% kernel, %.2f%% user" %
+          (total, 100.0 * ktotal / total, 100.0 * (total - ktotal) / total))
+    print("per cpu: " + ", ".join("cpu%s %d" % (c, n) for c, n in sorted(percpu.items())))
+    print()
+    report("kernel", kcounts, total, top)
+    report("user", ucounts, total, top)
+
+
+if __name__ == "__main__":
+    main()
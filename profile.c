@@ -0,0 +1,154 @@
+// Statistical profiler.  While profiling is on, every timer
+// interrupt on every CPU records the interrupted %eip together
+// with the CPU, the running process and the privilege level in
+// a per-CPU buffer.  profctl() can also speed the local APIC
+// timers up so that several samples are taken per clock tick;
+// the extra interrupts are not counted as ticks.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "prof.h"
+
+struct profbuf {
+  struct spinlock lock;
+  uint n;            // samples in s[]
+  uint dropped;      // samples lost because s[] was full
+  struct profsample s[NPROFSAMPLE];
+};
+
+static struct profbuf profbufs[NCPU];
+
+static struct {
+  struct spinlock lock;  // serializes profctl()
+  volatile int on;
+  volatile int rate;     // timer interrupts per clock tick
+} prof;
+
+void
+profinit(void)
+{
+  int i;
+
+  initlock(&prof.lock, "prof");
+  for(i = 0; i < NCPU; i++)
+    initlock(&profbufs[i].lock, "profbuf");
+  prof.on = 0;
+  prof.rate = 1;
+}
+
+// Called on every timer interrupt, with interrupts disabled.
+// Records a sample if profiling is on.  Returns 0 if this
+// interrupt was only generated for sampling and must not
+// be treated as a clock tick.
+int
+proftick(struct trapframe *tf)
+{
+  struct cpu *c;
+  struct proc *p;
+  struct profbuf *b;
+  struct profsample *s;
+
+  c = mycpu();
+  if(c->profrate != prof.rate){
+    c->profrate = prof.rate;
+    c->profsub = 0;
+    lapicsettimer(c->profrate);
+  }
+
+  if(prof.on){
+    b = &profbufs[cpuid()];
+    acquire(&b->lock);
+    if(b->n < NPROFSAMPLE){
+      s = &b->s[b->n++];
+      p = c->proc;
+      s->eip = tf->eip;
+      s->cpu = cpuid();
+      s->user = (tf->cs&3) == DPL_USER;
+      s->pid = p ? p->pid : 0;
+      if(p)
+        memmove(s->name, p->name, sizeof(s->name));
+      else
+        memset(s->name, 0, sizeof(s->name));
+    } else
+      b->dropped++;
+    release(&b->lock);
+  }
+
+  if(++c->profsub < c->profrate)
+    return 0;
+  c->profsub = 0;
+  return 1;
+}
+
+// Start (on != 0) or stop profiling.  Starting discards any
+// samples not yet read and takes rate samples per clock tick.
+// Stopping returns the number of samples dropped because a
+// buffer filled up.
+int
+profctl(int on, int rate)
+{
+  int i, dropped;
+
+  if(on && (rate < 1 || rate > PROFMAXRATE))
+    return -1;
+
+  acquire(&prof.lock);
+  dropped = 0;
+  if(on){
+    for(i = 0; i < NCPU; i++){
+      acquire(&profbufs[i].lock);
+      profbufs[i].n = 0;
+      profbufs[i].dropped = 0;
+      release(&profbufs[i].lock);
+    }
+    prof.rate = rate;
+    prof.on = 1;
+  } else {
+    prof.on = 0;
+    prof.rate = 1;
+    for(i = 0; i < NCPU; i++)
+      dropped += profbufs[i].dropped;
+  }
+  release(&prof.lock);
+  return dropped;
+}
+
+// Move up to n samples out of the per-CPU buffers into dst.
+// Each buffer is drained from its most recent sample backwards.
+// Returns the number of samples copied.
+int
+profread(struct profsample *dst, int n)
+{
+  struct profsample tmp[16];
+  struct profbuf *b;
+  int i, k, total;
+
+  total = 0;
+  for(i = 0; i < NCPU && total < n; i++){
+    b = &profbufs[i];
+    for(;;){
+      // Stage through tmp so that dst, which is user
+      // memory, is not written while b->lock is held.
+      acquire(&b->lock);
+      k = b->n;
+      if(k > NELEM(tmp))
+        k = NELEM(tmp);
+      if(k > n - total)
+        k = n - total;
+      b->n -= k;
+      memmove(tmp, &b->s[b->n], k*sizeof(tmp[0]));
+      release(&b->lock);
+      if(k == 0)
+        break;
+      memmove(dst + total, tmp, k*sizeof(tmp[0]));
+      total += k;
+    }
+  }
+  return total;
+}
@@ -2,6 +2,7 @@
 #include "stat.h"
 #include "param.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "user.h"
 #include "fs.h"
@@ -0,0 +1,2 @@
+// Resources for getrlimit() and setrlimit().
+#define RLIMIT_STACK  3  // Bytes of stack; takes effect at the next exec()
@@ -52,6 +52,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+int gettoken(char**, char*, char**, char**);
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +131,113 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// Is the command line in buf a pipeline of simple commands with
+// at most stdin/stdout redirections, which spawn() can start
+// without a forked shell?  Anything else, including syntax
+// errors, is left to a forked shell to parse and run, so that
+// errors do not kill this one.
+int
+simplecmd(char *buf)
+{
+  char *s, *es;
+  int tok, argc;
+
+  s = buf;
+  es = s + strlen(s);
+  argc = 0;
+  while((tok = gettoken(&s, es, 0, 0)) != 0){
+    switch(tok){
+    case 'a':
+      if(++argc >= MAXARGS)
+        return 0;
+      break;
+    case '|':
+      argc = 0;
+      break;
+    case '<':
+    case '>':
+    case '+':
+      if(gettoken(&s, es, 0, 0) != 'a')
+        return 0;
+      break;
+    default:
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Start cmd, built from a line that simplecmd() accepted, with
+// fds[0], fds[1] and fds[2] as its standard descriptors.
+// Returns the number of processes started.
+int
+spawncmd(struct cmd *cmd, int *fds)
+{
+  int p[2], sfds[3], fd, n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  default:
+    panic("spawncmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, fds) < 0){
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      printf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    memmove(sfds, fds, sizeof(sfds));
+    sfds[rcmd->fd] = fd;
+    n = spawncmd(rcmd->cmd, sfds);
+    close(fd);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      printf(2, "pipe failed\n");
+      return 0;
+    }
+    memmove(sfds, fds, sizeof(sfds));
+    sfds[1] = p[1];
+    n = spawncmd(pcmd->left, sfds);
+    sfds[0] = p[0];
+    sfds[1] = fds[1];
+    n += spawncmd(pcmd->right, sfds);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+}
+
+// Free a command built from a line that simplecmd() accepted.
+void
+freecmd(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  }
+  free(cmd);
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +253,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  static int fds[3] = { 0, 1, 2 };
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,6 +274,15 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(simplecmd(buf)){
+      // Start the programs directly rather than copying
+      // this shell only for it to exec them.
+      cmd = parsecmd(buf);
+      for(n = spawncmd(cmd, fds); n > 0; n--)
+        wait();
+      freecmd(cmd);
+      continue;
+    }
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait();
@@ -0,0 +1,239 @@
+// Shared memory segments, after System V.
+//
+// shmget(key, size) finds the segment with key, or creates it;
+// key 0 always makes a new segment.  shmat(id) maps a segment
+// into the calling process as a shared mapping (see mmap.c),
+// and shmdt(addr) unmaps it.  shmrm(id) removes a segment: it
+// can no longer be found or attached, and goes as soon as
+// nothing maps it.  The segment's pages are allocated
+// zeroed when first touched and mapped, not copied, into every
+// process attaching it; children made by fork() share it too.
+// Each page carries a reference for the segment and one for
+// each page table mapping it, so the memory is freed once the
+// last process detaches or exits.  A segment that was never
+// attached stays until shmrm().
+//
+// Shared anonymous mappings are backed by segments too, made
+// by shmanon() and never in the table, so that fork() children
+// can fault in their pages instead of fork() populating them.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "mman.h"
+
+// A segment and its page array share one kalloc_order() block.
+struct shm {
+  int id;                 // Slot in shmtab, or -1 if removed or anonymous
+  int anon;               // Backs a shared anonymous mapping
+  int key;
+  int ref;                // Mappings of this segment
+  int order;              // Of the block holding it
+  uint npage;
+  char *page[];           // 0 until first touched
+};
+
+struct {
+  struct spinlock lock;
+  struct shm *shm[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Allocate a segment of npage pages, in no slot.  Returns 0
+// if memory is short or its page array would not fit in the
+// largest block.
+static struct shm*
+shmalloc(uint npage)
+{
+  struct shm *s;
+  uint size;
+  int order;
+
+  size = sizeof(struct shm) + npage*sizeof(char*);
+  for(order = 0; (PGSIZE << order) < size; order++)
+    if(order == MAXORDER)
+      return 0;
+  if((s = (struct shm*)kalloc_order(order)) == 0)
+    return 0;
+  memset(s, 0, size);
+  s->id = -1;
+  s->order = order;
+  s->npage = npage;
+  return s;
+}
+
+// Free segment s and its pages.  Page tables still holding
+// them keep them until they are freed.  Caller holds
+// shmtab.lock.
+static void
+shmfree(struct shm *s)
+{
+  int i;
+
+  for(i = 0; i < s->npage; i++)
+    if(s->page[i])
+      kfree(s->page[i]);
+  if(s->id >= 0)
+    shmtab.shm[s->id] = 0;
+  kfree_order((char*)s, s->order);
+}
+
+// Return the id of the segment with key, creating it with
+// size bytes if there is none.  Returns -1 if an existing
+// segment is smaller than size or the table is full.
+int
+shmget(int key, uint size)
+{
+  struct shm *s;
+  int id, fid;
+
+  if(size == 0 || size > NSHMPAGE*PGSIZE)
+    return -1;
+  acquire(&shmtab.lock);
+  fid = -1;
+  for(id = 0; id < NSHM; id++){
+    s = shmtab.shm[id];
+    if(s && key != 0 && s->key == key){
+      if(s->npage*PGSIZE < size)
+        id = -1;
+      release(&shmtab.lock);
+      return id;
+    }
+    if(s == 0 && fid < 0)
+      fid = id;
+  }
+  if(fid < 0 || (s = shmalloc(PGROUNDUP(size) / PGSIZE)) == 0){
+    release(&shmtab.lock);
+    return -1;
+  }
+  s->id = fid;
+  s->key = key;
+  shmtab.shm[fid] = s;
+  release(&shmtab.lock);
+  return fid;
+}
+
+// Make a segment of len bytes for a shared anonymous mapping,
+// with a reference for the caller.  Returns 0 if memory is
+// short.
+struct shm*
+shmanon(uint len)
+{
+  struct shm *s;
+
+  if((s = shmalloc(len / PGSIZE)) != 0){
+    s->anon = 1;
+    s->ref = 1;
+  }
+  return s;
+}
+
+// Attach segment id to the current process.  Returns its
+// address or -1.
+int
+shmat(int id)
+{
+  struct shm *s;
+  uint len;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  acquire(&shmtab.lock);
+  // Hold a reference while adding the mapping, so a
+  // concurrent last detach cannot free the segment.
+  if((s = shmtab.shm[id]) != 0)
+    s->ref++;
+  release(&shmtab.lock);
+  if(s == 0)
+    return -1;
+  len = s->npage*PGSIZE;
+  id = addvma(0, len, PROT_READ|PROT_WRITE, MAP_SHARED, 0, 0, s);
+  // Drop the reference, freeing the segment only if it was
+  // removed meanwhile: one nobody has attached yet stays.
+  acquire(&shmtab.lock);
+  if(--s->ref == 0 && s->id < 0)
+    shmfree(s);
+  release(&shmtab.lock);
+  return id;
+}
+
+// Remove segment id.  It is freed now if nothing maps it, or
+// else when the last mapping goes.
+int
+shmrm(int id)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  acquire(&shmtab.lock);
+  if((s = shmtab.shm[id]) == 0){
+    release(&shmtab.lock);
+    return -1;
+  }
+  shmtab.shm[id] = 0;
+  s->id = -1;
+  if(s->ref == 0)
+    shmfree(s);
+  release(&shmtab.lock);
+  return 0;
+}
+
+// Detach the segment attached at addr from the current process.
+int
+shmdt(uint addr)
+{
+  struct vma *v;
+
+  if((v = findvma(myproc(), addr)) == 0 || v->shm == 0 || v->shm->anon ||
+     v->addr != addr)
+    return -1;
+  return munmap(v->addr, v->len);
+}
+
+// Add a mapping's reference to segment s.
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Drop a mapping's reference to segment s, freeing it when
+// nothing maps it any more.
+void
+shmclose(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  if(--s->ref == 0)
+    shmfree(s);
+  release(&shmtab.lock);
+}
+
+// Return page i of segment s, allocating it if it has never
+// been touched, with a reference for the caller to map it.
+char*
+shmpage(struct shm *s, uint i)
+{
+  char *mem;
+
+  if(i >= s->npage)
+    return 0;
+  acquire(&shmtab.lock);
+  if(s->page[i] == 0)
+    s->page[i] = kalloc_zeroed();
+  if((mem = s->page[i]) != 0)
+    kincref(mem);
+  release(&shmtab.lock);
+  return mem;
+}
@@ -0,0 +1,163 @@
+#include "types.h"
+#include "user.h"
+
+// Exercise shared memory segments: attach by key from
+// unrelated children, inherit across fork, remove them with
+// shmrm(), and stream data
+// from a producer to a consumer through a ring of pages
+// guarded by semaphores living in the segment, checking that
+// a process waiting on one sleeps rather than spins.
+//
+//   shmtest [nchunk]
+
+#define KEY    0x5348
+#define NSLOT  4
+#define CHUNK  4096
+
+struct ring {
+    struct sem full, empty;
+    int nchild;
+    int seen[8];
+    char slot[NSLOT][CHUNK];
+};
+
+void fail(char *what) {
+    printf(1, "shmtest: %s failed\n", what);
+    exit();
+}
+
+// Children find the segment by key and write their marks.
+void keytest(void) {
+    struct ring *r;
+    int i, id, pid;
+
+    if((id = shmget(KEY, sizeof(struct ring))) < 0)
+        fail("shmget");
+    if((r = shmat(id)) == (void*)-1)
+        fail("shmat");
+    for(i = 0; i < 8; i++) {
+        if((pid = fork()) < 0)
+            fail("fork");
+        if(pid == 0) {
+            struct ring *q;
+
+            // A fresh attachment of the same segment.
+            if((q = shmat(shmget(KEY, sizeof(struct ring)))) == (void*)-1)
+                fail("child shmat");
+            q->seen[i] = i + 1;
+            shmdt(q);
+            exit();
+        }
+    }
+    for(i = 0; i < 8; i++)
+        wait();
+    for(i = 0; i < 8; i++)
+        if(r->seen[i] != i + 1)
+            fail("writes through another attachment");
+    if(shmget(KEY, sizeof(struct ring) + 64*4096) >= 0)
+        fail("shmget larger than segment");
+    if(shmdt((char*)r + 4096) >= 0)
+        fail("shmdt of wrong address");
+    if(shmdt(r) < 0)
+        fail("shmdt");
+}
+
+// Removed segments give their slots back, and an attached
+// one stays usable until it is detached.
+void rmtest(void) {
+    char *p;
+    int i, id;
+
+    for(i = 0; i < 64; i++) {
+        if((id = shmget(0, 1)) < 0)
+            fail("shmget after shmrm");
+        if(shmrm(id) < 0)
+            fail("shmrm");
+    }
+    if((id = shmget(KEY, 4096)) < 0 || (p = shmat(id)) == (void*)-1)
+        fail("shmat");
+    if(shmrm(id) < 0)
+        fail("shmrm of attached segment");
+    p[0] = 'a';
+    if(shmat(id) != (void*)-1 || shmrm(id) >= 0)
+        fail("removed segment");
+    if(shmget(KEY, 4096) == id)
+        fail("key of removed segment");
+    shmrm(shmget(KEY, 4096));
+    if(p[0] != 'a' || shmdt(p) < 0)
+        fail("removed segment while attached");
+}
+
+// A child waiting on a semaphore in the segment sleeps in
+// futex_wait() until the parent posts it, using next to no
+// CPU time meanwhile.
+void blocktest(void) {
+    struct ring *r;
+    int pid, wtime, rtime;
+
+    if((r = shmat(shmget(0, sizeof(struct ring)))) == (void*)-1)
+        fail("shmat");
+    sem_init(&r->full, 0);
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0) {
+        sem_wait(&r->full);
+        exit();
+    }
+    sleep(20);
+    if(r->full.nwait != 1)
+        fail("futex_wait on shared memory");
+    sem_post(&r->full);
+    if(waitx(&wtime, &rtime) != pid)
+        fail("waitx");
+    if(rtime > 5)
+        fail("sleeping in sem_wait");
+    shmdt(r);
+}
+
+// A child inherits the attachment and produces nchunk pages.
+void streamtest(int nchunk) {
+    struct ring *r;
+    int i, j, pid, start;
+
+    if((r = shmat(shmget(0, sizeof(struct ring)))) == (void*)-1)
+        fail("shmat");
+    sem_init(&r->full, 0);
+    sem_init(&r->empty, NSLOT);
+
+    start = uptime();
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0) {
+        for(i = 0; i < nchunk; i++) {
+            sem_wait(&r->empty);
+            for(j = 0; j < CHUNK; j++)
+                r->slot[i % NSLOT][j] = i + j;
+            sem_post(&r->full);
+        }
+        exit();
+    }
+    for(i = 0; i < nchunk; i++) {
+        sem_wait(&r->full);
+        for(j = 0; j < CHUNK; j++)
+            if(r->slot[i % NSLOT][j] != (char)(i + j))
+                fail("stream contents");
+        sem_post(&r->empty);
+    }
+    wait();
+    printf(1, "shmtest: %d KB through shared memory in %d ticks\n",
+           nchunk * CHUNK / 1024, uptime() - start);
+    shmdt(r);
+}
+
+int main(int argc, char *argv[]) {
+    int nchunk;
+
+    nchunk = argc > 1 ? atoi(argv[1]) : 256;
+    keytest();
+    rmtest();
+    blocktest();
+    streamtest(nchunk);
+    printf(1, "shmtest OK\n");
+    exit();
+}
@@ -0,0 +1,185 @@
+// Slab allocator for fixed-size kernel objects.
+//
+// A slab is one page from kalloc(): a struct slab header
+// followed by as many objects as fit.  Free objects in a slab
+// are chained through their first word, and slabs with free
+// objects are kept on their cache's partial list.  A slab is
+// returned to kalloc() as soon as all its objects are free.
+//
+// In front of the slabs, each CPU has a magazine of up to
+// NSLABMAG free objects per cache.  It is only touched by its
+// own CPU with interrupts off, so it needs no lock; the cache
+// lock is taken only to move NSLABMAG/2 objects at a time
+// between a magazine and the slabs.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct slab *next;   // on the partial list
+  struct slab *prev;
+  void *free;          // free objects in this slab
+  int inuse;           // objects handed out
+};
+
+#define SLABHDR  ((sizeof(struct slab) + 7) & ~7)
+
+// All caches, for statistics.
+static struct slabcache *slabcaches;
+
+// Set up cache c for objects of the given size.
+// Called during boot, before other CPUs start.
+void
+slabinit(struct slabcache *c, char *name, uint size)
+{
+  if(size < sizeof(void*))
+    size = sizeof(void*);
+  size = (size + 7) & ~7;
+  if(SLABHDR + size > PGSIZE)
+    panic("slabinit: object too big");
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  c->partial = 0;
+  c->nslab = 0;
+  c->nobj = 0;
+  memset(c->mag, 0, sizeof(c->mag));
+  c->next = slabcaches;
+  slabcaches = c;
+}
+
+static void
+partialremove(struct slabcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+partialpush(struct slabcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+// Take one object from the slabs, allocating a new slab
+// if none has room.  Caller holds c->lock.
+static void*
+slabget(struct slabcache *c)
+{
+  struct slab *s;
+  char *p;
+  void *obj;
+  uint i;
+
+  if((s = c->partial) == 0){
+    if((s = (struct slab*)kalloc()) == 0)
+      return 0;
+    s->free = 0;
+    s->inuse = 0;
+    p = (char*)s + SLABHDR;
+    for(i = 0; i < c->perslab; i++, p += c->size){
+      *(void**)p = s->free;
+      s->free = p;
+    }
+    partialpush(c, s);
+    c->nslab++;
+  }
+  obj = s->free;
+  s->free = *(void**)obj;
+  s->inuse++;
+  c->nobj++;
+  if(s->free == 0)
+    partialremove(c, s);
+  return obj;
+}
+
+// Return one object to its slab.  Caller holds c->lock.
+static void
+slabput(struct slabcache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->free == 0)
+    partialpush(c, s);
+  *(void**)obj = s->free;
+  s->free = obj;
+  s->inuse--;
+  c->nobj--;
+  if(s->inuse == 0){
+    partialremove(c, s);
+    c->nslab--;
+    kfree((char*)s);
+  }
+}
+
+// Allocate an object from c.  Its contents are undefined.
+// Returns 0 if out of memory.
+void*
+slaballoc(struct slabcache *c)
+{
+  struct slabmag *m;
+  void *obj;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < NSLABMAG/2 && (obj = slabget(c)) != 0)
+      m->obj[m->n++] = obj;
+    release(&c->lock);
+  }
+  obj = m->n > 0 ? m->obj[--m->n] : 0;
+  popcli();
+  return obj;
+}
+
+// Free an object allocated from c.
+void
+slabfree(struct slabcache *c, void *obj)
+{
+  struct slabmag *m;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == NSLABMAG){
+    acquire(&c->lock);
+    while(m->n > NSLABMAG/2)
+      slabput(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  popcli();
+}
+
+// Return the pages held by cache c, or by all caches if c is 0.
+uint
+slabpages(struct slabcache *c)
+{
+  struct slabcache *cc;
+  uint n;
+
+  n = 0;
+  for(cc = slabcaches; cc; cc = cc->next){
+    if(c && cc != c)
+      continue;
+    acquire(&cc->lock);
+    n += cc->nslab;
+    release(&cc->lock);
+  }
+  return n;
+}
@@ -0,0 +1,19 @@
+// A slab cache hands out fixed-size kernel objects carved
+// from whole pages.  Each CPU keeps a small magazine of free
+// objects, so most allocations and frees take no lock.
+struct slabmag {
+  int n;
+  void *obj[NSLABMAG];
+};
+
+struct slabcache {
+  struct spinlock lock;
+  char *name;
+  uint size;               // bytes per object
+  uint perslab;            // objects per slab
+  struct slab *partial;    // slabs with free objects
+  uint nslab;              // slabs (pages) in use
+  uint nobj;               // objects allocated from slabs
+  struct slabcache *next;  // in the list of all caches
+  struct slabmag mag[NCPU];
+};
@@ -6,8 +6,36 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
-#include "proc.h"
 #include "spinlock.h"
+#include "proc.h"
+#include "lockstat.h"
+
+#ifdef LOCKSTAT
+// Every initialized lock is recorded here so that lockstat()
+// can find it.  Slots are claimed with cmpxchg rather than under
+// a lock because initlock() runs before mycpu() works.
+// statlock keeps freelock() from retiring a lock while
+// lockstatread() is looking at it.
+static struct spinlock *lockstats[NLOCKSTAT];
+static struct spinlock statlock = { .name = "lockstat" };
+
+static void
+lockstatreg(struct spinlock *lk)
+{
+  int i;
+
+  lk->nacquire = 0;
+  lk->ncontended = 0;
+  lk->spincycles = 0;
+  lk->maxhold = 0;
+  lk->maxpcs[0] = 0;
+  for(i = 0; i < NLOCKSTAT; i++)
+    if(lockstats[i] == 0 &&
+       cmpxchg((uint*)&lockstats[i], 0, (uint)lk) == 0)
+      return;
+  // Table full; this lock just goes untracked.
+}
+#endif
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -15,22 +43,97 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->tail = 0;
+  lk->owner = 0;
+#ifdef LOCKSTAT
+  lockstatreg(lk);
+#endif
+}
+
+// Retire a lock whose memory is about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+#ifdef LOCKSTAT
+  int i;
+
+  acquire(&statlock);
+  for(i = 0; i < NLOCKSTAT; i++)
+    if(lockstats[i] == lk)
+      lockstats[i] = 0;
+  release(&statlock);
+#endif
+}
+
+// A CPU waiting for or holding a lock is represented in the
+// lock's queue by one of its qnodes.  A CPU can hold several
+// locks at once, so each has NQNODE of them; they are only
+// touched with interrupts off, so no lock protects them.
+struct qnode {
+  struct qnode *volatile next;  // Next CPU in the lock's queue.
+  volatile uint wait;           // Spin until the predecessor clears this.
+  uint busy;                    // In use by an acquired or pending lock.
+} __attribute__((aligned(64)));  // One cache line each.
+
+static struct qnode qnodes[NCPU][NQNODE];
+
+static struct qnode*
+qalloc(void)
+{
+  struct qnode *q;
+
+  for(q = qnodes[cpuid()]; q < &qnodes[cpuid()][NQNODE]; q++)
+    if(!q->busy){
+      q->busy = 1;
+      return q;
+    }
+  panic("acquire: out of qnodes");
 }
 
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 // Holding a lock for a long time may cause
 // other CPUs to waste time spinning to acquire it.
+//
+// This is an MCS queue lock: a CPU swaps its qnode into lk->tail
+// and, if the lock was held, links behind its predecessor and
+// spins on its own qnode until the predecessor hands the lock
+// over in release().  Waiters are served in FIFO order and each
+// spins on its own cache line instead of all of them hammering
+// the lock word.
 void
 acquire(struct spinlock *lk)
 {
+  struct qnode *q, *pred;
+#ifdef LOCKSTAT
+  uint64 start;
+#endif
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
+#ifdef LOCKSTAT
+  start = rdtsc();
+#endif
+  q = qalloc();
+  q->next = 0;
+  q->wait = 1;
+
   // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  pred = (struct qnode*)xchg((uint*)&lk->tail, (uint)q);
+  if(pred){
+    pred->next = q;
+    while(q->wait)
+      pause();
+#ifdef LOCKSTAT
+    lk->ncontended++;
+    lk->spincycles += rdtsc() - start;
+#endif
+  }
+#ifdef LOCKSTAT
+  lk->nacquire++;
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -38,19 +141,40 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for debugging.
+  lk->owner = q;
+  lk->locked = 1;
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+#ifdef LOCKSTAT
+  lk->tacquire = rdtsc();
+#endif
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  struct qnode *q;
+#ifdef LOCKSTAT
+  uint64 hold;
+#endif
+
   if(!holding(lk))
     panic("release");
 
+#ifdef LOCKSTAT
+  hold = rdtsc() - lk->tacquire;
+  if(hold > lk->maxhold){
+    lk->maxhold = hold;
+    memmove(lk->maxpcs, lk->pcs, sizeof(lk->pcs));
+  }
+#endif
+
+  q = lk->owner;
+  lk->owner = 0;
   lk->pcs[0] = 0;
   lk->cpu = 0;
+  lk->locked = 0;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that all the stores in the critical
@@ -59,11 +183,19 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // If nobody is queued behind us, swing the tail back to empty.
+  // If that fails, a new waiter has swapped itself in but not yet
+  // linked to us; wait for the link, then pass the lock on.
+  if(q->next == 0){
+    if(cmpxchg((uint*)&lk->tail, (uint)q, 0) == (uint)q)
+      goto done;
+    while(q->next == 0)
+      pause();
+  }
+  q->next->wait = 0;
 
+done:
+  q->busy = 0;
   popcli();
 }
 
@@ -124,3 +256,198 @@ popcli(void)
     sti();
 }
 
+
+//PAGEBREAK: 40
+// Reader-writer locks.  cnt holds the number of readers;
+// RW_WRITER is set while a writer holds the lock, and RW_WAITING
+// while a writer is waiting for the readers to drain.
+
+#define RW_WRITER  0x80000000
+#define RW_WAITING 0x40000000
+
+void
+initrwlock(struct rwlock *rw, char *name)
+{
+  rw->name = name;
+  rw->cnt = 0;
+  rw->cpu = 0;
+}
+
+void
+acquireread(struct rwlock *rw)
+{
+  uint v;
+
+  pushcli(); // disable interrupts to avoid deadlock.
+  if(rw->cpu == mycpu())
+    panic("acquireread");
+  for(;;){
+    v = rw->cnt;
+    if((v & (RW_WRITER|RW_WAITING)) == 0 && cmpxchg(&rw->cnt, v, v+1) == v)
+      break;
+    pause();
+  }
+  __sync_synchronize();
+}
+
+void
+releaseread(struct rwlock *rw)
+{
+  if((rw->cnt & ~(RW_WRITER|RW_WAITING)) == 0)
+    panic("releaseread");
+  __sync_synchronize();
+  __sync_fetch_and_sub(&rw->cnt, 1);
+  popcli();
+}
+
+void
+acquirewrite(struct rwlock *rw)
+{
+  uint v;
+
+  pushcli(); // disable interrupts to avoid deadlock.
+  if(rw->cpu == mycpu())
+    panic("acquirewrite");
+  for(;;){
+    v = rw->cnt;
+    if((v & ~RW_WAITING) == 0){
+      if(cmpxchg(&rw->cnt, v, RW_WRITER) == v)
+        break;
+    } else if((v & RW_WAITING) == 0)
+      cmpxchg(&rw->cnt, v, v | RW_WAITING);
+    pause();
+  }
+  __sync_synchronize();
+  rw->cpu = mycpu();
+}
+
+void
+releasewrite(struct rwlock *rw)
+{
+  if((rw->cnt & RW_WRITER) == 0 || rw->cpu != mycpu())
+    panic("releasewrite");
+  rw->cpu = 0;
+  __sync_synchronize();
+  // Another writer may have set RW_WAITING meanwhile; keep it.
+  __sync_fetch_and_and(&rw->cnt, ~RW_WRITER);
+  popcli();
+}
+
+//PAGEBREAK: 30
+// Sequence locks.  A reader does
+//   do {
+//     seq = seqreadbegin(sl);
+//     ... read the data ...
+//   } while(seqreadretry(sl, seq));
+
+void
+initseqlock(struct seqlock *sl, char *name)
+{
+  initlock(&sl->lock, name);
+  sl->seq = 0;
+}
+
+void
+seqwritebegin(struct seqlock *sl)
+{
+  acquire(&sl->lock);
+  sl->seq++;
+  __sync_synchronize();
+}
+
+void
+seqwriteend(struct seqlock *sl)
+{
+  __sync_synchronize();
+  sl->seq++;
+  release(&sl->lock);
+}
+
+// Wait out any writer in progress and return the
+// sequence number to hand to seqreadretry().
+uint
+seqreadbegin(struct seqlock *sl)
+{
+  uint seq;
+
+  while((seq = sl->seq) & 1)
+    pause();
+  __sync_synchronize();
+  return seq;
+}
+
+// Did a writer run since seqreadbegin() returned seq?
+int
+seqreadretry(struct seqlock *sl, uint seq)
+{
+  __sync_synchronize();
+  return sl->seq != seq;
+}
+
+// Lock torture test: acquire and release a lock shared by all
+// callers, doing a little work while holding it, until nticks
+// clock ticks have passed.  Returns the number of acquisitions.
+static struct spinlock torturelock = { .name = "torture" };
+static volatile uint torturecount;
+
+int
+locktorture(int nticks)
+{
+  uint start, n;
+  volatile int i;
+
+  n = 0;
+  start = ticks;
+  while(*(volatile uint*)&ticks - start < nticks){
+    acquire(&torturelock);
+    torturecount++;
+    for(i = 0; i < 50; i++)
+      ;
+    release(&torturelock);
+    n++;
+  }
+  return n;
+}
+
+// Copy the statistics of up to n tracked locks that have been
+// acquired at least once into the struct lockstat array at dst.
+// If reset is set, zero the counters of every tracked lock.
+// Returns the number of entries copied, or -1 if the kernel
+// was built without LOCKSTAT.
+int
+lockstatread(struct lockstat *dst, int n, int reset)
+{
+#ifdef LOCKSTAT
+  struct lockstat ls;
+  struct spinlock *lk;
+  int i, found, k;
+
+  k = 0;
+  for(i = 0; i < NLOCKSTAT; i++){
+    found = 0;
+    acquire(&statlock);
+    if((lk = lockstats[i]) != 0 && lk->nacquire > 0){
+      safestrcpy(ls.name, lk->name, sizeof(ls.name));
+      ls.nacquire = lk->nacquire;
+      ls.ncontended = lk->ncontended;
+      ls.spincycles = lk->spincycles;
+      ls.maxhold = lk->maxhold;
+      memmove(ls.pcs, lk->maxpcs, sizeof(ls.pcs));
+      if(reset){
+        lk->nacquire = 0;
+        lk->ncontended = 0;
+        lk->spincycles = 0;
+        lk->maxhold = 0;
+      }
+      found = 1;
+    }
+    release(&statlock);
+    // Copy out without holding statlock.
+    if(found && k < n)
+      dst[k++] = ls;
+  }
+  return k;
+#else
+  return -1;
+#endif
+}
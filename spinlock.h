@@ -1,5 +1,7 @@
 // Mutual exclusion lock.
 struct spinlock {
+  struct qnode *tail;  // Last CPU queued for the lock (see spinlock.c).
+  struct qnode *owner; // Queue node of the holder.
   uint locked;       // Is the lock held?
 
   // For debugging:
@@ -7,5 +9,31 @@ struct spinlock {
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+
+#ifdef LOCKSTAT
+  // Contention statistics, reported by lockstat().
+  uint nacquire;     // Number of acquisitions.
+  uint ncontended;   // Acquisitions that found the lock held.
+  uint64 spincycles; // Total cycles spent spinning in acquire().
+  uint64 maxhold;    // Longest hold time, in cycles.
+  uint64 tacquire;   // Time stamp of the current acquisition.
+  uint maxpcs[10];   // Call stack of the longest hold.
+#endif
+};
+
+// Reader-writer spin lock: any number of readers, or one writer.
+// A waiting writer holds off new readers so it cannot starve.
+struct rwlock {
+  volatile uint cnt;   // Readers holding the lock, plus flag bits.
+  char *name;          // Name of lock.
+  struct cpu *cpu;     // The cpu holding the write lock.
+};
+
+// Sequence lock, for data read far more often than written.
+// Writers serialize on lock and keep seq odd while updating;
+// readers take no lock and retry if seq moved under them.
+struct seqlock {
+  volatile uint seq;
+  struct spinlock lock;
 };
 
@@ -0,0 +1,123 @@
+#include "types.h"
+#include "resource.h"
+#include "user.h"
+
+// Exercise the growable user stack: recurse deeper than one
+// page, keep the stack across fork(), fault on the guard page
+// past the limit, and run with a larger limit after exec().
+//
+//   stacktest
+
+#define FRAME 1024
+
+void fail(char *what) {
+    printf(1, "stacktest: %s failed\n", what);
+    exit();
+}
+
+// Recurse depth times, using about FRAME bytes of stack each
+// time.  Returns the sum of the frames' marks.
+int recurse(int depth) {
+    char frame[FRAME];
+    int i;
+
+    for(i = 0; i < FRAME; i++)
+        frame[i] = depth;
+    if(depth == 0)
+        return 0;
+    i = recurse(depth - 1);
+    if(frame[0] != (char)depth || frame[FRAME-1] != (char)depth)
+        fail("stack contents");
+    return i + depth;
+}
+
+// Most of the default 1MB limit.
+void growtest(void) {
+    int n;
+
+    n = 900;
+    if(recurse(n) != n*(n+1)/2)
+        fail("deep recursion");
+}
+
+// The child gets a copy of the stack, pages and all.
+void forktest(void) {
+    char buf[64*FRAME];
+    int pid;
+
+    buf[0] = 'p';
+    buf[sizeof(buf)-1] = 'q';
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0) {
+        if(buf[0] != 'p' || buf[sizeof(buf)-1] != 'q')
+            fail("stack across fork");
+        buf[0] = 'c';
+        exit();
+    }
+    wait();
+    if(buf[0] != 'p')
+        fail("stack copy-on-write");
+}
+
+// Recursing past the limit hits the guard page, which kills
+// the child; the parent carries on.
+void overflowtest(void) {
+    int fds[2], pid;
+    char c;
+
+    if(pipe(fds) < 0)
+        fail("pipe");
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0) {
+        close(fds[0]);
+        printf(1, "stacktest: overflowing the stack, expect a trap\n");
+        recurse(getrlimit(RLIMIT_STACK) / FRAME + 16);
+        write(fds[1], "x", 1);
+        exit();
+    }
+    close(fds[1]);
+    if(read(fds[0], &c, 1) != 0)
+        fail("guard page");
+    close(fds[0]);
+    wait();
+}
+
+// A larger limit takes effect at exec().
+void limittest(void) {
+    char *argv[] = { "stacktest", "deep", 0 };
+    int pid;
+
+    if(setrlimit(RLIMIT_STACK, 0) >= 0)
+        fail("setrlimit of 0");
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0) {
+        if(setrlimit(RLIMIT_STACK, 4*1024*1024) < 0)
+            fail("setrlimit");
+        if(getrlimit(RLIMIT_STACK) != 4*1024*1024)
+            fail("getrlimit");
+        exec("stacktest", argv);
+        fail("exec");
+    }
+    wait();
+}
+
+int main(int argc, char *argv[]) {
+    int n;
+
+    if(argc > 1) {
+        // Run by limittest.
+        n = 3*1024;
+        if(recurse(n) != n*(n+1)/2)
+            fail("recursion under a larger limit");
+        exit();
+    }
+    growtest();
+    forktest();
+    overflowtest();
+    limittest();
+    printf(1, "stacktest OK\n");
+    exit();
+}
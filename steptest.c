@@ -0,0 +1,92 @@
+#include "types.h"
+#include "mmu.h"
+#include "syscall.h"
+#include "user.h"
+#include "x86.h"
+
+// Enter the kernel with sysenter while single-stepping, and
+// check that the kernel survives, that the system call runs
+// and that the trap flag, like the user's other flags, comes
+// back with the return.
+//
+//   steptest
+
+void fail(char *what) {
+    printf(1, "steptest: %s failed\n", what);
+    exit();
+}
+
+// write(fd, buf, n) through sysenter, as the usys.S stub
+// makes it, but with the bits of flags set in %eflags first.
+// The popfl right before the sysenter makes FL_TF take effect
+// on the sysenter itself.
+int flagwrite(uint flags, int fd, char *buf, int n) {
+    uint a[4];
+    int r;
+
+    a[0] = flags;
+    a[1] = fd;
+    a[2] = (uint)buf;
+    a[3] = n;
+    asm volatile("pushl 12(%1)\n\t"
+                 "pushl 8(%1)\n\t"
+                 "pushl 4(%1)\n\t"
+                 "pushl $0\n\t"           // the stub's return address
+                 "pushfl\n\t"
+                 "movl (%1), %%ecx\n\t"
+                 "orl %%ecx, (%%esp)\n\t"
+                 "movl $1f, %%edx\n\t"
+                 "leal 4(%%esp), %%ecx\n\t"
+                 "popfl\n\t"
+                 "sysenter\n"
+                 "1:\n\t"
+                 "addl $16, %%esp"
+                 : "=a" (r) : "r" (a), "0" (SYS_write)
+                 : "ecx", "edx", "memory", "cc");
+    return r;
+}
+
+// The child's write runs, and it dies on the single-step trap
+// after its first instruction back in user space.
+void steptest(void) {
+    int fds[2], pid;
+    char buf[2];
+
+    if(pipe(fds) < 0)
+        fail("pipe");
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0) {
+        close(fds[0]);
+        printf(1, "steptest: single-stepping into sysenter, expect a trap\n");
+        flagwrite(FL_TF, fds[1], "s", 1);
+        write(fds[1], "x", 1);
+        exit();
+    }
+    close(fds[1]);
+    if(read(fds[0], buf, 1) != 1 || buf[0] != 's')
+        fail("system call while single-stepping");
+    if(read(fds[0], buf, 1) != 0)
+        fail("trap flag after sysexit");
+    close(fds[0]);
+    wait();
+}
+
+// Other flags come back too.
+void flagtest(void) {
+    uint eflags;
+
+    if(flagwrite(FL_AC, 1, "", 0) != 0)
+        fail("write");
+    eflags = readeflags();
+    asm volatile("pushfl; andl %0, (%%esp); popfl" : : "i" (~FL_AC) : "cc");
+    if(!(eflags & FL_AC))
+        fail("flags after sysexit");
+}
+
+int main(int argc, char *argv[]) {
+    steptest();
+    flagtest();
+    printf(1, "steptest OK\n");
+    exit();
+}
@@ -0,0 +1,218 @@
+// Swapping of user pages to the swap area, a region that mkfs
+// reserves on the disk after the file system.
+//
+// When memory is short, swapout() picks pages with the clock
+// algorithm: a hand sweeps over processes' pages (see
+// swapscan() in proc.c and vmevict() in vm.c), giving each
+// page that was used since it last passed a second chance by
+// clearing its accessed bit, and taking the first that was not.
+// The page's entry is replaced by one naming a swap slot, and
+// the page is written to the slot and freed.  pagefault() calls
+// swapin() to read a page back when the process touches it.
+//
+// Only processes that will not touch their user memory with
+// spinlocks held before they next return to user space give up
+// pages: those preempted in user code, or sleeping in wait()
+// or sleep() (see proc->swappable).  A fault on a swapped-out
+// page must be able to sleep.  Pages shared with another page
+// table, 4MB pages and memory mappings are never swapped out.
+//
+// A slot is counted once for each page table entry naming it,
+// so fork() can copy the entries, and once for each swapin()
+// or swapout() using it, so it cannot be reused under them.
+// While a page is being written to its slot, it stays in
+// swap.page[], and swapin() copies it from there.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+#define BPP        (PGSIZE/BSIZE)   // blocks per page
+#define NSWAPSLOT  (SWAPSIZE/BPP)
+
+struct {
+  struct spinlock lock;
+  struct sleeplock evict;   // one swapout() at a time
+  uint start;               // first block of the swap area
+  int nslot;
+  int nfree;
+  ushort ref[NSWAPSLOT];
+  char *page[NSWAPSLOT];    // being written to the slot, or 0
+  struct buf rbuf;          // for reading slots
+  struct buf wbuf;          // for writing them
+} swap;
+
+void
+swapinit(int dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.evict, "swapout");
+  initsleeplock(&swap.rbuf.lock, "swapin");
+  initsleeplock(&swap.wbuf.lock, "swapwrite");
+  readsb(dev, &sb);
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / BPP;
+  if(swap.nslot > NSWAPSLOT)
+    swap.nslot = NSWAPSLOT;
+  swap.nfree = swap.nslot;
+}
+
+// Report the swap area's size and free space, in slots of a
+// page each.
+void
+swapstat(uint *nslot, uint *nfree)
+{
+  acquire(&swap.lock);
+  *nslot = swap.nslot;
+  *nfree = swap.nfree;
+  release(&swap.lock);
+}
+
+// Find a free slot for page mem, which is about to be written
+// to it, with references for the page table entry and for
+// swapout().  Returns -1 if the swap area is full.
+int
+swapalloc(char *mem)
+{
+  int i;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++)
+    if(swap.ref[i] == 0){
+      swap.ref[i] = 2;
+      swap.page[i] = mem;
+      swap.nfree--;
+      release(&swap.lock);
+      return i;
+    }
+  release(&swap.lock);
+  return -1;
+}
+
+// Add a reference to slot.
+void
+swapdup(int slot)
+{
+  acquire(&swap.lock);
+  if(slot < 0 || slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot, freeing it if that was the last.
+void
+swapfree(int slot)
+{
+  acquire(&swap.lock);
+  if(slot < 0 || slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nfree++;
+  release(&swap.lock);
+}
+
+// Read or write the page at mem from or to slot.  Goes to the
+// disk directly, through buffers of its own: swap traffic
+// would only push file system blocks out of the buffer cache.
+static void
+swaprw(char *mem, int slot, int write)
+{
+  struct buf *b;
+  int i;
+
+  b = write ? &swap.wbuf : &swap.rbuf;
+  acquiresleep(&b->lock);
+  b->dev = ROOTDEV;
+  for(i = 0; i < BPP; i++){
+    b->blockno = swap.start + slot*BPP + i;
+    if(write){
+      memmove(b->data, mem + i*BSIZE, BSIZE);
+      b->flags = B_DIRTY;
+    } else
+      b->flags = 0;
+    iderw(b);
+    if(!write)
+      memmove(mem + i*BSIZE, b->data, BSIZE);
+  }
+  releasesleep(&b->lock);
+}
+
+// Free memory by swapping out up to n pages, fewer if the swap
+// area fills or the clock finds nothing to take.  Returns how
+// many were freed.  Sleeps; must not be called with spinlocks
+// held.
+int
+swapout(int n)
+{
+  char *page[SWAPBATCH];
+  uint slot[SWAPBATCH];
+  int i;
+
+  if(swap.nslot == 0)
+    return 0;
+  if(n > SWAPBATCH)
+    n = SWAPBATCH;
+  acquiresleep(&swap.evict);
+  n = swapscan(page, slot, n);
+  for(i = 0; i < n; i++){
+    swaprw(page[i], slot[i], 1);
+    acquire(&swap.lock);
+    swap.page[slot[i]] = 0;
+    release(&swap.lock);
+    kfree(page[i]);
+    swapfree(slot[i]);
+  }
+  releasesleep(&swap.evict);
+  return n;
+}
+
+// If the page at va in pgdir, the current process's page
+// table, is swapped out, read it back in.  Returns 0 if the
+// page is in memory now, or was not swapped out; -2 if memory
+// is short.
+int
+swapin(pde_t *pgdir, uint va)
+{
+  struct spinlock *lk;
+  char *mem;
+  int slot;
+
+  lk = vmlock(pgdir);
+  acquire(lk);
+  if((slot = vmswapped(pgdir, va)) >= 0)
+    swapdup(slot);
+  release(lk);
+  if(slot < 0)
+    return 0;
+
+  if((mem = kalloc()) == 0){
+    swapfree(slot);
+    return -2;
+  }
+  acquire(&swap.lock);
+  if(swap.page[slot]){
+    // Still being written out.
+    memmove(mem, swap.page[slot], PGSIZE);
+    release(&swap.lock);
+  } else {
+    release(&swap.lock);
+    swaprw(mem, slot, 0);
+  }
+
+  // Another thread may have read it in meanwhile.
+  acquire(lk);
+  if(vmswapin(pgdir, va, slot, mem) < 0)
+    kfree(mem);
+  release(lk);
+  swapfree(slot);
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include "types.h"
+#include "syscall.h"
+#include "traps.h"
+#include "user.h"
+
+// Null system call latency: time n calls of getpid() with the
+// cycle counter and report the average in cycles, for the
+// library's getpid(), which reads the vDSO page, for its
+// sysenter stub and for int $T_SYSCALL.  The totals must fit
+// in 32 bits, so keep n moderate.
+//
+//   sysbench [n]
+
+static inline uint64 rdtsc(void) {
+    uint64 tsc;
+
+    asm volatile("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
+// getpid() the old way.
+int intgetpid(void) {
+    int pid;
+
+    asm volatile("int %1" : "=a" (pid) : "i" (T_SYSCALL), "a" (SYS_getpid)
+                 : "memory");
+    return pid;
+}
+
+int main(int argc, char *argv[]) {
+    uint64 start;
+    uint t;
+    int i, n;
+
+    n = argc > 1 ? atoi(argv[1]) : 100000;
+    if(n < 1) {
+        printf(2, "usage: sysbench [n]\n");
+        exit();
+    }
+    if(intgetpid() != getpid() || sysgetpid() != getpid()) {
+        printf(2, "sysbench: getpid mismatch\n");
+        exit();
+    }
+
+    start = rdtsc();
+    for(i = 0; i < n; i++)
+        getpid();
+    t = rdtsc() - start;
+    printf(1, "getpid: %d cycles per call\n", t / n);
+
+    start = rdtsc();
+    for(i = 0; i < n; i++)
+        sysgetpid();
+    t = rdtsc() - start;
+    printf(1, "getpid with sysenter: %d cycles per call\n", t / n);
+
+    start = rdtsc();
+    for(i = 0; i < n; i++)
+        intgetpid();
+    t = rdtsc() - start;
+    printf(1, "getpid with int: %d cycles per call\n", t / n);
+    exit();
+}
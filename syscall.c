@@ -3,11 +3,13 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
 
-// User code makes a system call with INT T_SYSCALL.
+// User code makes a system call with SYSENTER (see usys.S and
+// sysentry in trapasm.S) or INT T_SYSCALL.
 // System call number in %eax.
 // Arguments on the stack, from the user call to the C
 // library system call function. The saved user %esp points
@@ -17,30 +19,32 @@
     int
 fetchint(uint addr, int *ip)
 {
-    struct proc *curproc = myproc();
+    uint ep;
 
-    if(addr >= curproc->sz || addr+4 > curproc->sz)
+    if((ep = memend(myproc(), addr)) == 0 || addr+4 > ep || addr+4 < addr)
         return -1;
     *ip = *(int*)(addr);
     return 0;
 }
 
-// Fetch the nul-terminated string at addr from the current process.
-// Doesn't actually copy the string - just sets *pp to point at it.
-// Returns length of string, not including nul.
+// Copy the nul-terminated string at addr in the current process
+// into buf, which holds max bytes.  Each byte is read from user
+// memory once, so another thread changing the string meanwhile
+// cannot make the kernel run past the end of user memory.
+// Returns length of string, not including nul, or -1 if it
+// does not end within user memory or does not fit.
     int
-fetchstr(uint addr, char **pp)
+fetchstr(uint addr, char *buf, int max)
 {
     char *s, *ep;
-    struct proc *curproc = myproc();
+    int i;
 
-    if(addr >= curproc->sz)
+    if((ep = (char*)memend(myproc(), addr)) == 0)
         return -1;
-    *pp = (char*)addr;
-    ep = (char*)curproc->sz;
-    for(s = *pp; s < ep; s++){
-        if(*s == 0)
-            return s - *pp;
+    for(i = 0, s = (char*)addr; i < max && s < ep; i++, s++){
+        buf[i] = *s;
+        if(buf[i] == 0)
+            return i;
     }
     return -1;
 }
@@ -53,33 +57,62 @@ argint(int n, int *ip)
 }
 
 // Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-    int
-argptr(int n, char **pp, int size)
+// to a block of memory of size bytes, which the kernel will
+// write if write is set.  Check that the block lies within the
+// process address space, below sz, in the stack or inside one
+// mapping, and map its untouched pages now, so that running
+// out of memory or writing to read-only memory fails the call
+// instead of a kernel page fault.
+    static int
+checkptr(int n, char **pp, int size, int write)
 {
     int i;
+    uint a, ep;
+    struct vma *v;
     struct proc *curproc = myproc();
 
     if(argint(n, &i) < 0)
         return -1;
-    if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+    if(size < 0 || (uint)i+size < (uint)i)
         return -1;
+    ep = memend(curproc, i);
+    if(ep == 0 || (uint)i+size > ep){
+        if((v = findvma(curproc, i)) == 0 || (uint)i+size > v->addr + v->len)
+            return -1;
+    }
+    for(a = PGROUNDDOWN(i); a < (uint)i+size; a += PGSIZE)
+        if(pagefault(a, write) < 0)
+            return -1;
     *pp = (char*)i;
     return 0;
 }
 
-// Fetch the nth word-sized system call argument as a string pointer.
-// Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes for the kernel to fill in.
+    int
+argptr(int n, char **pp, int size)
+{
+    return checkptr(n, pp, size, 1);
+}
+
+// Like argptr, for a block the kernel only reads.
+    int
+argrptr(int n, char **pp, int size)
+{
+    return checkptr(n, pp, size, 0);
+}
+
+// Fetch the nth word-sized system call argument as a string,
+// copied into buf, which holds max bytes.  The kernel must use
+// the copy: threads share writable memory, so the user's string
+// can change under it.  Returns the string's length or -1.
     int
-argstr(int n, char **pp)
+argstr(int n, char *buf, int max)
 {
     int addr;
     if(argint(n, &addr) < 0)
         return -1;
-    return fetchstr(addr, pp);
+    return fetchstr(addr, buf, max);
 }
 
 extern int sys_chdir(void);
@@ -106,6 +139,25 @@ extern int sys_uptime(void);
 extern int sys_waitx(void);
 extern int sys_set_priority(void);
 extern int sys_ps_func(void);
+extern int sys_lockstat(void);
+extern int sys_profctl(void);
+extern int sys_profread(void);
+extern int sys_locktorture(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_buddyinfo(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_spawn(void);
+extern int sys_getrlimit(void);
+extern int sys_setrlimit(void);
+extern int sys_memstat(void);
+extern int sys_shmrm(void);
 
 static int (*syscalls[])(void) = {
     [SYS_fork]    sys_fork,
@@ -132,6 +184,25 @@ static int (*syscalls[])(void) = {
     [SYS_waitx]   sys_waitx,
     [SYS_set_priority]   sys_set_priority,
     [SYS_ps_func]   sys_ps_func,
+    [SYS_lockstat]  sys_lockstat,
+    [SYS_profctl]   sys_profctl,
+    [SYS_profread]  sys_profread,
+    [SYS_locktorture] sys_locktorture,
+    [SYS_futex_wait] sys_futex_wait,
+    [SYS_futex_wake] sys_futex_wake,
+    [SYS_clone]   sys_clone,
+    [SYS_join]    sys_join,
+    [SYS_buddyinfo] sys_buddyinfo,
+    [SYS_mmap]    sys_mmap,
+    [SYS_munmap]  sys_munmap,
+    [SYS_shmget]  sys_shmget,
+    [SYS_shmat]   sys_shmat,
+    [SYS_shmdt]   sys_shmdt,
+    [SYS_spawn]   sys_spawn,
+    [SYS_getrlimit] sys_getrlimit,
+    [SYS_setrlimit] sys_setrlimit,
+    [SYS_memstat] sys_memstat,
+    [SYS_shmrm]   sys_shmrm,
 };
 
     void
@@ -23,3 +23,22 @@
 #define SYS_waitx  22
 #define SYS_set_priority 23
 #define SYS_ps_func 24
+#define SYS_lockstat 25
+#define SYS_profctl 26
+#define SYS_profread 27
+#define SYS_locktorture 28
+#define SYS_futex_wait 29
+#define SYS_futex_wake 30
+#define SYS_clone  31
+#define SYS_join   32
+#define SYS_buddyinfo 33
+#define SYS_mmap   34
+#define SYS_munmap 35
+#define SYS_shmget 36
+#define SYS_shmat  37
+#define SYS_shmdt  38
+#define SYS_spawn  39
+#define SYS_getrlimit 40
+#define SYS_setrlimit 41
+#define SYS_memstat 42
+#define SYS_shmrm  43
@@ -5,7 +5,13 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
+#include "lockstat.h"
+#include "prof.h"
+#include "buddy.h"
+#include "resource.h"
+#include "memstat.h"
 
     int
 sys_fork(void)
@@ -50,8 +56,9 @@ sys_sbrk(void)
 
     if(argint(0, &n) < 0)
         return -1;
-    addr = myproc()->sz;
-    if(growproc(n) < 0)
+    // growproc returns the old size, read under the same
+    // lock as the resize in case other threads are growing too.
+    if((addr = growproc(n)) < 0)
         return -1;
     return addr;
 }
@@ -64,16 +71,19 @@ sys_sleep(void)
 
     if(argint(0, &n) < 0)
         return -1;
-    acquire(&tickslock);
+    acquire(&tickslock.lock);
     ticks0 = ticks;
     while(ticks - ticks0 < n){
         if(myproc()->killed){
-            release(&tickslock);
+            release(&tickslock.lock);
             return -1;
         }
-        sleep(&ticks, &tickslock);
+        // Sleeping here, the process can give up its pages.
+        myproc()->swappable = 1;
+        sleep(&ticks, &tickslock.lock);
+        myproc()->swappable = 0;
     }
-    release(&tickslock);
+    release(&tickslock.lock);
     return 0;
 }
 
@@ -82,11 +92,12 @@ sys_sleep(void)
     int
 sys_uptime(void)
 {
-    uint xticks;
+    uint xticks, seq;
 
-    acquire(&tickslock);
-    xticks = ticks;
-    release(&tickslock);
+    do {
+        seq = seqreadbegin(&tickslock);
+        xticks = ticks;
+    } while(seqreadretry(&tickslock, seq));
     return xticks;
 }
 
@@ -117,3 +128,175 @@ int sys_set_priority(void) {
 int sys_ps_func(void) {
     return ps_func();
 }
+
+int sys_lockstat(void) {
+    struct lockstat *buf;
+    int n, reset;
+
+    if (argint(1, &n) < 0 || n < 0)
+        return -1;
+    // No more can be returned, and n*sizeof(*buf) must not wrap.
+    if (n > NLOCKSTAT)
+        n = NLOCKSTAT;
+
+    if (argptr(0, (char **)&buf, n*sizeof(*buf)) < 0)
+        return -1;
+
+    if (argint(2, &reset) < 0)
+        return -1;
+
+    return lockstatread(buf, n, reset);
+}
+
+int sys_profctl(void) {
+    int on, rate;
+
+    if (argint(0, &on) < 0)
+        return -1;
+
+    if (argint(1, &rate) < 0)
+        return -1;
+
+    return profctl(on, rate);
+}
+
+int sys_profread(void) {
+    struct profsample *buf;
+    int n;
+
+    if (argint(1, &n) < 0 || n < 0)
+        return -1;
+    // No more can be buffered, and n*sizeof(*buf) must not wrap.
+    if (n > NCPU*NPROFSAMPLE)
+        n = NCPU*NPROFSAMPLE;
+
+    if (argptr(0, (char **)&buf, n*sizeof(*buf)) < 0)
+        return -1;
+
+    return profread(buf, n);
+}
+
+int sys_locktorture(void) {
+    int nticks;
+
+    if (argint(0, &nticks) < 0 || nticks < 0)
+        return -1;
+
+    return locktorture(nticks);
+}
+
+int sys_futex_wait(void) {
+    int addr, val;
+
+    if (argint(0, &addr) < 0 || argint(1, &val) < 0)
+        return -1;
+
+    return futexwait(addr, val);
+}
+
+int sys_futex_wake(void) {
+    int addr, n;
+
+    if (argint(0, &addr) < 0 || argint(1, &n) < 0 || n < 0)
+        return -1;
+
+    return futexwake(addr, n);
+}
+
+int sys_clone(void) {
+    int fn, stack, arg;
+
+    if (argint(0, &fn) < 0 || argint(1, &stack) < 0 || argint(2, &arg) < 0)
+        return -1;
+
+    return clone((void (*)(void*))fn, (void*)stack, (void*)arg);
+}
+
+int sys_join(void) {
+    void **stack;
+
+    if (argptr(0, (char **)&stack, sizeof(void*)) < 0)
+        return -1;
+
+    return join(stack);
+}
+
+int sys_buddyinfo(void) {
+    struct buddyinfo *ubi, bi;
+
+    if (argptr(0, (char **)&ubi, sizeof(*ubi)) < 0)
+        return -1;
+
+    buddyinfo(&bi);
+    memmove(ubi, &bi, sizeof(bi));
+    return 0;
+}
+
+int sys_memstat(void) {
+    struct memstat *ums, ms;
+    struct procmem *pm;
+    int n, r;
+
+    if(argint(2, &n) < 0 || n < 0 || n > NPROC)
+        return -1;
+    if(argptr(0, (char **)&ums, sizeof(*ums)) < 0 ||
+       argptr(1, (char **)&pm, n*sizeof(*pm)) < 0)
+        return -1;
+
+    r = memstat(&ms, pm, n);
+    memmove(ums, &ms, sizeof(ms));
+    return r;
+}
+
+int sys_shmget(void) {
+    int key, size;
+
+    if(argint(0, &key) < 0 || argint(1, &size) < 0)
+        return -1;
+    return shmget(key, size);
+}
+
+int sys_shmat(void) {
+    int id;
+
+    if(argint(0, &id) < 0)
+        return -1;
+    return shmat(id);
+}
+
+int sys_shmdt(void) {
+    int addr;
+
+    if(argint(0, &addr) < 0)
+        return -1;
+    return shmdt(addr);
+}
+
+int sys_shmrm(void) {
+    int id;
+
+    if(argint(0, &id) < 0)
+        return -1;
+    return shmrm(id);
+}
+
+// Return the current limit on resource.
+int sys_getrlimit(void) {
+    int resource;
+
+    if(argint(0, &resource) < 0 || resource != RLIMIT_STACK)
+        return -1;
+    return myproc()->stacklimit;
+}
+
+// Set the limit on resource.  A new stack limit, rounded up to
+// whole pages, sizes the stack of the next program exec'd.
+int sys_setrlimit(void) {
+    int resource, limit;
+
+    if(argint(0, &resource) < 0 || argint(1, &limit) < 0 ||
+       resource != RLIMIT_STACK || limit <= 0 || limit > MAXSTACK)
+        return -1;
+    myproc()->stacklimit = PGROUNDUP(limit);
+    return 0;
+}
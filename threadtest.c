@@ -0,0 +1,133 @@
+#include "types.h"
+#include "user.h"
+
+// Exercise clone()/join() threads and the futex-based locks.
+//
+//   threadtest [nthread]
+//
+// Threads increment a shared counter under a mutex, pass a
+// token back and forth with semaphores, run a bounded buffer
+// with condition variables and grow the heap concurrently.
+
+#define NITER 1000
+#define NBUF  4
+
+struct mutex lock;
+struct cond notfull, notempty;
+struct sem ping, pong;
+int counter;
+int buf[NBUF], nbuf, head;
+int sum;
+
+void fail(char *what) {
+    printf(1, "threadtest: %s failed\n", what);
+    exit();
+}
+
+void incr(void *arg) {
+    int i;
+
+    for(i = 0; i < NITER; i++) {
+        mutex_lock(&lock);
+        counter++;
+        mutex_unlock(&lock);
+    }
+}
+
+void pinger(void *arg) {
+    int i;
+
+    for(i = 0; i < NITER; i++) {
+        sem_wait(&ping);
+        sem_post(&pong);
+    }
+}
+
+void consumer(void *arg) {
+    int i;
+
+    for(i = 0; i < NITER; i++) {
+        mutex_lock(&lock);
+        while(nbuf == 0)
+            cond_wait(&notempty, &lock);
+        sum += buf[head];
+        head = (head + 1) % NBUF;
+        nbuf--;
+        cond_signal(&notfull);
+        mutex_unlock(&lock);
+    }
+}
+
+void grow(void *arg) {
+    char *p[16];
+    int i, j;
+
+    for(i = 0; i < 16; i++) {
+        if((p[i] = malloc(4096)) == 0)
+            fail("malloc");
+        memset(p[i], i, 4096);
+    }
+    for(i = 0; i < 16; i++) {
+        for(j = 0; j < 4096; j++)
+            if(p[i][j] != i)
+                fail("heap");
+        free(p[i]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int nthread, i, start;
+
+    nthread = argc > 1 ? atoi(argv[1]) : 4;
+    mutex_init(&lock);
+    cond_init(&notfull);
+    cond_init(&notempty);
+    sem_init(&ping, 0);
+    sem_init(&pong, 0);
+
+    for(i = 0; i < nthread; i++)
+        if(thread_create(incr, 0) < 0)
+            fail("thread_create");
+    for(i = 0; i < nthread; i++)
+        if(thread_join() < 0)
+            fail("thread_join");
+    if(counter != nthread * NITER)
+        fail("mutex");
+    printf(1, "mutex: %d threads, counter %d\n", nthread, counter);
+
+    start = uptime();
+    if(thread_create(pinger, 0) < 0)
+        fail("thread_create");
+    for(i = 0; i < NITER; i++) {
+        sem_post(&ping);
+        sem_wait(&pong);
+    }
+    thread_join();
+    printf(1, "sem: %d round trips in %d ticks\n", NITER, uptime() - start);
+
+    if(thread_create(consumer, 0) < 0)
+        fail("thread_create");
+    for(i = 0; i < NITER; i++) {
+        mutex_lock(&lock);
+        while(nbuf == NBUF)
+            cond_wait(&notfull, &lock);
+        buf[(head + nbuf) % NBUF] = i;
+        nbuf++;
+        cond_signal(&notempty);
+        mutex_unlock(&lock);
+    }
+    thread_join();
+    if(sum != NITER * (NITER - 1) / 2)
+        fail("cond");
+    printf(1, "cond: sum %d\n", sum);
+
+    for(i = 0; i < nthread; i++)
+        if(thread_create(grow, 0) < 0)
+            fail("thread_create");
+    for(i = 0; i < nthread; i++)
+        thread_join();
+    if(join(0) >= 0 || wait() >= 0)
+        fail("join with no threads");
+    printf(1, "threadtest ok\n");
+    exit();
+}
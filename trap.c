@@ -3,15 +3,16 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
-#include "spinlock.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
-struct spinlock tickslock;
+extern void debugtrap(void), sysentry(void);  // in trapasm.S
+struct seqlock tickslock;
 uint ticks;
 int q_max_ticks[5] = {1, 2, 4, 8, 16};
 
@@ -21,12 +22,27 @@ void tvinit(void) {
     for(i = 0; i < 256; i++)
         SETGATE(idt[i], 0, SEG_KCODE<<3, vectors[i], 0);
     SETGATE(idt[T_SYSCALL], 1, SEG_KCODE<<3, vectors[T_SYSCALL], DPL_USER);
+    SETGATE(idt[T_DEBUG], 0, SEG_KCODE<<3, (uint)debugtrap, 0);
 
-    initlock(&tickslock, "time");
+    initseqlock(&tickslock, "time");
 }
 
+// Load the IDT, and point sysenter at sysentry (trapasm.S).
+// sysenter starts on this CPU's entry stack, whose top word
+// holds the address of ts.esp0: the top of the running
+// process's kernel stack, as set by switchuvm().  Only a debug
+// trap, taken when user code single-steps into sysenter, is
+// ever pushed on the entry stack (see debugtrap).
 void idtinit(void) {
+    struct cpu *c = mycpu();
+    uint *top;
+
     lidt(idt, sizeof(idt));
+    top = &c->sysstack[NELEM(c->sysstack) - 1];
+    *top = (uint)&c->ts.esp0;
+    wrmsr(MSR_SYSENTER_CS, SEG_KCODE<<3);
+    wrmsr(MSR_SYSENTER_ESP, (uint)top);
+    wrmsr(MSR_SYSENTER_EIP, (uint)sysentry);
 }
 
 //PAGEBREAK: 41
@@ -43,11 +59,17 @@ void trap(struct trapframe *tf) {
 
     switch(tf->trapno){
         case T_IRQ0 + IRQ_TIMER:
+            if(!proftick(tf)){
+                // Extra interrupt taken only for profiling.
+                lapiceoi();
+                return;
+            }
             if(cpuid() == 0){
-                acquire(&tickslock);
+                seqwritebegin(&tickslock);
                 ticks++;
+                vdsotick(ticks);
+                seqwriteend(&tickslock);
                 wakeup(&ticks);
-                release(&tickslock);
                 inc_r_io_time();
                 //if(myproc()) {
                     //if(myproc()->state == SLEEPING) {
@@ -82,6 +104,14 @@ void trap(struct trapframe *tf) {
             lapiceoi();
             break;
 
+        case T_PGFLT:
+            // Untouched heap memory or a write to a copy-on-write
+            // page, from user code or from the kernel using user
+            // memory.
+            if(myproc() && pagefault(rcr2(), tf->err & FEC_WR) == 0)
+                break;
+            // fall through
+
             //PAGEBREAK: 13
         default:
             if(myproc() == 0){
@@ -116,18 +146,18 @@ void trap(struct trapframe *tf) {
         myproc()->q_ticks[myproc()->prev_q]++;
         if((myproc()->cur_q_ticks >= q_max_ticks[myproc()->prev_q])) { //If the timeslices are utilized demote the process
             demote_q(myproc());
-            yield();
+            preempt((tf->cs&3) == DPL_USER);
             // Check if the process has been killed since we yielded
             if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
                 exit();
         }
 #elif RR
-        yield();
+        preempt((tf->cs&3) == DPL_USER);
         // Check if the process has been killed since we yielded
         if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
             exit();
 #elif PBS
-        yield();
+        preempt((tf->cs&3) == DPL_USER);
         // Check if the process has been killed since we yielded
         if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
             exit();
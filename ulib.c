@@ -1,8 +1,10 @@
 #include "types.h"
 #include "stat.h"
 #include "fcntl.h"
+#include "param.h"
 #include "user.h"
 #include "x86.h"
+#include "vdso.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -104,3 +106,159 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Mutexes, condition variables and semaphores for processes
+// or threads sharing memory, built on futex_wait/futex_wake so
+// that a waiter sleeps in the kernel instead of spinning and is
+// woken as soon as the word it waits on changes.
+
+// A mutex is 0 when unlocked, 1 when locked, and 2 when
+// locked with possible waiters, so that an uncontended
+// unlock needs no system call.
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  uint c;
+
+  if((c = cmpxchg(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = xchg(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = xchg(&m->state, 2);
+  }
+}
+
+int
+mutex_trylock(struct mutex *m)
+{
+  return cmpxchg(&m->state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(xchg(&m->state, 0) == 2)
+    futex_wake(&m->state, 1);
+}
+
+// A condition variable is a sequence number bumped by
+// every signal; a waiter sleeps only if it has not moved
+// since the waiter released the mutex.
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  uint seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  // Other threads may be asleep on m; take it as contended
+  // so that our unlock will wake them.
+  while(xchg(&m->state, 2) != 0)
+    futex_wait(&m->state, 2);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, NPROC);
+}
+
+void
+sem_init(struct sem *s, int n)
+{
+  s->count = n;
+  s->nwait = 0;
+}
+
+void
+sem_wait(struct sem *s)
+{
+  uint n;
+
+  for(;;){
+    n = s->count;
+    if(n > 0){
+      if(cmpxchg(&s->count, n, n - 1) == n)
+        return;
+      continue;
+    }
+    __sync_fetch_and_add(&s->nwait, 1);
+    futex_wait(&s->count, 0);
+    __sync_fetch_and_sub(&s->nwait, 1);
+  }
+}
+
+void
+sem_post(struct sem *s)
+{
+  __sync_fetch_and_add(&s->count, 1);
+  if(s->nwait)
+    futex_wake(&s->count, 1);
+}
+
+// The clock and the pid come from the vDSO pages that the
+// kernel maps into every process (see vdso.h), without
+// entering the kernel.
+
+int
+uptime(void)
+{
+  return ((struct vdsotime*)VDSO)->ticks;
+}
+
+// Uptime in thousandths of a tick, interpolated from the
+// time-stamp counter since the last tick.  Wraps around after
+// about 4 million ticks.
+uint
+fineuptime(void)
+{
+  struct vdsotime *vt = (struct vdsotime*)VDSO;
+  uint seq, t, delta, per;
+
+  do {
+    while((seq = vt->seq) & 1)
+      ;
+    __sync_synchronize();
+    t = vt->ticks;
+    delta = rdtsc() - vt->tsc;
+    per = vt->tscpertick / 1000;
+    __sync_synchronize();
+  } while(vt->seq != seq);
+  if(per == 0)
+    return t * 1000;
+  delta /= per;
+  return t * 1000 + (delta < 999 ? delta : 999);
+}
+
+int
+getpid(void)
+{
+  int pid;
+
+  if((pid = ((struct vdsoproc*)VDSOPROC)->pid) != 0)
+    return pid;
+  return sysgetpid();
+}
@@ -1,5 +1,24 @@
 struct stat;
 struct rtcdate;
+struct lockstat;
+struct profsample;
+struct buddyinfo;
+struct memstat;
+struct procmem;
+
+// Futex-based locks (ulib.c)
+struct mutex {
+  volatile uint state;
+};
+
+struct cond {
+  volatile uint seq;
+};
+
+struct sem {
+  volatile uint count;
+  volatile uint nwait;
+};
 
 // system calls
 int fork(void);
@@ -19,13 +38,31 @@ int link(const char*, const char*);
 int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
-int getpid(void);
+int sysgetpid(void);
 char* sbrk(int);
 int sleep(int);
-int uptime(void);
 int waitx(int*, int*);
 int set_priority(int, int);
 int ps_func(void);
+int lockstat(struct lockstat*, int, int);
+int profctl(int, int);
+int profread(struct profsample*, int);
+int locktorture(int);
+int futex_wait(volatile uint*, uint);
+int futex_wake(volatile uint*, int);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int buddyinfo(struct buddyinfo*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+int spawn(char*, char**, int*);
+int getrlimit(int);
+int setrlimit(int, int);
+int memstat(struct memstat*, struct procmem*, int);
+int shmrm(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +77,21 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int uptime(void);
+uint fineuptime(void);
+int getpid(void);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+void sem_init(struct sem*, int);
+void sem_wait(struct sem*);
+void sem_post(struct sem*);
+
+// uthread.c
+int thread_create(void(*)(void*), void*);
+int thread_join(void);
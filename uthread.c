@@ -0,0 +1,56 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mmu.h"
+
+// Threads on top of clone() and join().  Each thread runs on a
+// one-page stack from malloc, which thread_join() frees, and
+// exits when its function returns.
+
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static void
+thread_start(void *a)
+{
+  struct tstart *ts = a;
+
+  ts->fn(ts->arg);
+  exit();
+}
+
+// Start fn(arg) in a new thread; return its pid or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  char *stack;
+  struct tstart *ts;
+  int pid;
+
+  if((stack = malloc(PGSIZE)) == 0)
+    return -1;
+  // Keep fn and arg at the far end of the stack from
+  // where it starts.
+  ts = (struct tstart*)stack;
+  ts->fn = fn;
+  ts->arg = arg;
+  if((pid = clone(thread_start, stack, ts)) < 0){
+    free(stack);
+    return -1;
+  }
+  return pid;
+}
+
+// Wait for a thread to exit; return its pid or -1.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) >= 0)
+    free(stack);
+  return pid;
+}
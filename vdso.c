@@ -0,0 +1,79 @@
+// Kernel side of the vDSO pages (see vdso.h): one time page
+// that every process maps read-only and the timer updates, and
+// one page per address space holding its process's pid.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "vdso.h"
+
+#if VDSO != USTACKTOP || VDSOPROC + PGSIZE != MMAPBASE
+#error "vdso.h does not match memlayout.h"
+#endif
+
+static struct vdsotime *vdsotime;
+
+void
+vdsoinit(void)
+{
+  if((vdsotime = (struct vdsotime*)kalloc_zeroed()) == 0)
+    panic("vdsoinit");
+}
+
+// Publish clock tick t, and how many time-stamp counter cycles
+// the last tick took.  Called by the timer interrupt on one CPU,
+// holding tickslock for writing.
+void
+vdsotick(uint t)
+{
+  uint64 now;
+
+  now = rdtsc();
+  vdsotime->seq++;
+  __sync_synchronize();
+  vdsotime->ticks = t;
+  if(vdsotime->tsc)
+    vdsotime->tscpertick = now - vdsotime->tsc;
+  vdsotime->tsc = now;
+  __sync_synchronize();
+  vdsotime->seq++;
+}
+
+// Map the vDSO pages into pgdir, with a new process page
+// holding pid.  Returns -1 if memory is short; the caller frees
+// pgdir, along with anything mapped already.
+int
+vdsomap(pde_t *pgdir, int pid)
+{
+  struct vdsoproc *vp;
+
+  if((vp = (struct vdsoproc*)kalloc_zeroed()) == 0)
+    return -1;
+  vp->pid = pid;
+  if(mappages(pgdir, (char*)VDSOPROC, PGSIZE, V2P(vp), PTE_U) < 0){
+    kfree((char*)vp);
+    return -1;
+  }
+  // The time page gets a reference for each page table, so
+  // that freevm() never frees it.
+  kincref((char*)vdsotime);
+  if(mappages(pgdir, (char*)VDSO, PGSIZE, V2P(vdsotime), PTE_U) < 0){
+    kfree((char*)vdsotime);
+    return -1;
+  }
+  return 0;
+}
+
+// Set the pid in pgdir's process page.  0 sends getpid() to
+// the kernel, for threads sharing pgdir.
+void
+vdsosetpid(pde_t *pgdir, int pid)
+{
+  struct vdsoproc *vp;
+
+  if((vp = (struct vdsoproc*)uva2ka(pgdir, (char*)VDSOPROC)) != 0)
+    vp->pid = pid;
+}
@@ -0,0 +1,21 @@
+// The vDSO pages, mapped read-only into every process just
+// above its stack, let user code read the time and its pid
+// without a system call (see vdso.c, and uptime() and getpid()
+// in ulib.c).
+
+#define VDSO      0x3FFFE000        // USTACKTOP in memlayout.h
+#define VDSOPROC  (VDSO + 4096)     // the process's own page
+
+// Shared by all processes, and written at each clock tick.
+// A reader retries if seq was odd or changed meanwhile.
+struct vdsotime {
+  volatile uint seq;
+  volatile uint ticks;              // as returned by uptime()
+  volatile uint64 tsc;              // time-stamp counter at that tick
+  volatile uint tscpertick;         // its increase over the last tick
+};
+
+// One per address space.
+struct vdsoproc {
+  volatile int pid;                 // 0 if threads share it: ask the kernel
+};
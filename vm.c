@@ -4,34 +4,60 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "elf.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// Page directory and page table pages allocated, for memstat.
+// Updated with atomic instructions rather than a lock.
+static uint npgtab;
+
+#if HUGEORDER > MAXORDER || HUGEPGSIZE != PGSIZE << HUGEORDER
+#error "kalloc_order() cannot allocate 4MB pages"
+#endif
+
 // Set up CPU's kernel segment descriptors.
-// Run once on entry on each CPU.
+// Run once on entry on each CPU, before anything calls mycpu().
 void
 seginit(void)
 {
   struct cpu *c;
+  int apicid;
+
+  // Find this CPU's struct cpu by its APIC ID.  APIC IDs are
+  // not guaranteed to be contiguous, so search for it.
+  apicid = lapicid();
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c->apicid == apicid)
+      break;
+  if(c == cpus+ncpu)
+    panic("seginit: unknown apicid");
 
   // Map "logical" addresses to virtual addresses using identity map.
   // Cannot share a CODE descriptor for both kernel and user
   // because it would have to have DPL_USR, but the CPU forbids
   // an interrupt from CPL=0 to DPL=3.
-  c = &cpus[cpuid()];
   c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0);
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+
+  // Map %gs to the struct cpu itself, so that mycpu() and
+  // myproc() are a single load.  alltraps reloads %gs, which
+  // user code may change.
+  c->gdt[SEG_KCPU] = SEG(STA_W, c, sizeof(*c) - 1, 0);
+  c->self = c;
   lgdt(c->gdt, sizeof(c->gdt));
+  loadgs(SEG_KCPU << 3);
 }
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages.  Returns 0 if va
+// lies in a 4MB page, which has no PTE (see hugepde).
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,13 +65,15 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
+    __sync_fetch_and_add(&npgtab, 1);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -57,7 +85,7 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
-static int
+int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 {
   char *a, *last;
@@ -79,6 +107,42 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Return the page directory entry mapping va in pgdir if it
+// is a 4MB page, otherwise 0.
+static pde_t*
+hugepde(pde_t *pgdir, uint va)
+{
+  pde_t *pde;
+
+  pde = &pgdir[PDX(va)];
+  if((*pde & (PTE_P|PTE_PS)) != (PTE_P|PTE_PS))
+    return 0;
+  return pde;
+}
+
+// Like mappages, but uses 4MB pages wherever va and pa are both
+// 4MB-aligned and at least 4MB remain, which saves a page table
+// page per 4MB and keeps the kernel's mappings to a few TLB
+// entries.  va, size and pa must be page-aligned.
+static int
+mapkpages(pde_t *pgdir, uint va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  for(; size > 0; va += n, pa += n, size -= n){
+    n = HUGEPGSIZE - va % HUGEPGSIZE;
+    if(n > size)
+      n = size;
+    if(n == HUGEPGSIZE && pa % HUGEPGSIZE == 0){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+    } else if(mappages(pgdir, (void*)va, n, pa, perm) < 0)
+      return -1;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -96,6 +160,13 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
+// The kernel's mappings use 4MB pages where they are aligned,
+// so only the first 4MB, holding I/O space and the kernel's
+// text, needs a page table.  kvmalloc() builds them once in
+// kpgdir and every other page table shares them.  They are
+// global (PTE_G), so loading %cr3 does not flush them from the
+// TLB.
+//
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
@@ -114,24 +185,18 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Set up kernel part of a page table, sharing kpgdir's page
+// tables.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  __sync_fetch_and_add(&npgtab, 1);
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
@@ -140,7 +205,17 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  if((kpgdir = (pde_t*)kalloc_zeroed()) == 0)
+    panic("kvmalloc");
+  npgtab++;
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkpages(kpgdir, (uint)k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm | PTE_G) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -152,6 +227,51 @@ switchkvm(void)
   lcr3(V2P(kpgdir));   // switch to the kernel page table
 }
 
+// Switch to the kernel-only page table if this CPU still has
+// the last process's loaded.  switchuvm() leaves it there in
+// case that process, or another thread of it, runs next; the
+// scheduler calls this when it finds nothing to run, so that
+// freevm() does not wait on an idle CPU.
+void
+idlekvm(void)
+{
+  struct cpu *c;
+
+  pushcli();
+  c = mycpu();
+  if(c->pgdir != kpgdir){
+    switchkvm();
+    c->pgdir = kpgdir;
+  }
+  popcli();
+}
+
+// Note that the current process has removed or changed
+// mappings in pgdir, so other CPUs that last ran it must load
+// %cr3 again before running it, rather than trust their TLBs.
+// This CPU flushes its own entries.  The CPUs cannot be running
+// it: a page table shared by threads only ever gains mappings.
+static void
+staleuvm(pde_t *pgdir)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c->pgdir == pgdir)
+      c->tlbstale = 1;
+}
+
+// Flush the TLB after the current process has unmapped some
+// of its memory.
+void
+flushuvm(void)
+{
+  struct proc *p = myproc();
+
+  staleuvm(p->pgdir);
+  lcr3(V2P(p->pgdir));
+}
+
 // Switch TSS and h/w page table to correspond to process p.
 void
 switchuvm(struct proc *p)
@@ -173,7 +293,13 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  // The kernel's mappings are the same in every page table, so
+  // there is nothing to do if p's is already loaded.
+  if(mycpu()->pgdir != p->pgdir || mycpu()->tlbstale){
+    mycpu()->pgdir = p->pgdir;
+    mycpu()->tlbstale = 0;
+    lcr3(V2P(p->pgdir));  // switch to process's address space
+  }
   popcli();
 }
 
@@ -186,36 +312,11 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -231,13 +332,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -255,6 +355,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  pde_t *pde;
   pte_t *pte;
   uint a, pa;
 
@@ -263,6 +364,13 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    // 4MB pages are only ever removed whole.
+    if((pde = hugepde(pgdir, a)) != 0){
+      kfree_order(P2V(PTE_ADDR(*pde)), HUGEORDER);
+      *pde = 0;
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -273,41 +381,129 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_ADDR(*pte) >> PTXSHIFT);
+      *pte = 0;
     }
   }
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part belongs to kpgdir.
 void
 freevm(pde_t *pgdir)
 {
+  struct cpu *c;
   uint i;
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
+  // Wait for other CPUs' schedulers to stop using pgdir: they
+  // leave it loaded after its last process stops running.
+  for(c = cpus; c < cpus+ncpu; c++)
+    while(c->pgdir == pgdir)
+      ;
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if((pgdir[i] & (PTE_P|PTE_PS)) == PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
+      __sync_fetch_and_sub(&npgtab, 1);
     }
   }
   kfree((char*)pgdir);
+  __sync_fetch_and_sub(&npgtab, 1);
 }
 
-// Clear PTE_U on a page. Used to create an inaccessible
-// page beneath the user stack.
-void
-clearpteu(pde_t *pgdir, char *uva)
+// Return the number of page directory and page table pages,
+// the kernel's included.
+uint
+pgtabpages(void)
 {
-  pte_t *pte;
+  return npgtab;
+}
 
-  pte = walkpgdir(pgdir, uva, 0);
-  if(pte == 0)
-    panic("clearpteu");
-  *pte &= ~PTE_U;
+// Map the user pages of pgdir between start and end into d
+// as well: private copies, the same pages copy-on-write if
+// cow is set, or the same pages outright if share is set.
+// Pages never touched are skipped.  For copy-on-write, pgdir
+// must be the current page table and must not be shared with
+// other threads, whose CPUs could keep writing through stale
+// TLB entries.  On failure, pages already made copy-on-write
+// stay that way; cowfault makes them writable on first use.
+// 4MB pages are never copy-on-write: unless shared, they are
+// copied at once.  Swapped-out pages stay swapped out.
+int
+dupuvm(pde_t *pgdir, pde_t *d, uint start, uint end, int share, int cow)
+{
+  pde_t *pde;
+  pte_t *pte, *dpte;
+  uint pa, i, flags;
+  char *mem;
+  int r;
+
+  r = 0;
+  for(i = start; i < end; i += PGSIZE){
+    if((pde = hugepde(pgdir, i)) != 0){
+      pa = PTE_ADDR(*pde);
+      if(share)
+        kincref(P2V(pa));
+      else if((mem = kalloc_order(HUGEORDER)) != 0){
+        memmove(mem, P2V(pa), HUGEPGSIZE);
+        pa = V2P(mem);
+      } else {
+        r = -1;
+        break;
+      }
+      d[PDX(i)] = pa | PTE_FLAGS(*pde);
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_SWAP){
+      // Both get the swap slot, and read their own copies back.
+      if((dpte = walkpgdir(d, (void *) i, 1)) == 0){
+        r = -1;
+        break;
+      }
+      swapdup(PTE_ADDR(*pte) >> PTXSHIFT);
+      *dpte = *pte;
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    if(!share && cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE_ADDR(*pte);
+    flags = PTE_FLAGS(*pte);
+    if(share || cow){
+      if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0){
+        r = -1;
+        break;
+      }
+      kincref(P2V(pa));
+    } else {
+      if((mem = kalloc()) == 0){
+        r = -1;
+        break;
+      }
+      memmove(mem, (char*)P2V(pa), PGSIZE);
+      if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
+        kfree(mem);
+        r = -1;
+        break;
+      }
+    }
+  }
+  if(!share && cow){
+    staleuvm(pgdir);
+    lcr3(V2P(pgdir));
+  }
+  return r;
 }
 
 // Given a parent process's page table, create a copy
@@ -316,43 +512,287 @@ pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
+  if(dupuvm(pgdir, d, 0, sz, 0, 0) < 0){
+    freevm(d);
+    return 0;
+  }
+  return d;
+}
+
+// Given a parent process's page table, create a child's that
+// shares all of its pages copy-on-write: writable pages become
+// read-only and PTE_COW in both, and the first write to one
+// by either side copies it (see cowfault).
+pde_t*
+cowuvm(pde_t *pgdir, uint sz)
+{
+  pde_t *d;
+
+  if((d = setupkvm()) == 0)
+    return 0;
+  if(dupuvm(pgdir, d, 0, sz, 0, 1) < 0){
+    freevm(d);
+    return 0;
+  }
+  return d;
+}
+
+// Handle a write to copy-on-write page va in pgdir: give the
+// page table a private, writable copy of the page, or just make
+// it writable if no one else shares it any more.  Returns -1 if
+// va is not a copy-on-write page, -2 if memory is short.  May run
+// with spinlocks held, when the kernel writes to user memory.
+static int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa;
+  char *mem;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (char*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  if(krefcnt(P2V(pa)) == 1){
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+  } else {
     if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
+      return -2;
+    memmove(mem, P2V(pa), PGSIZE);
+    *pte = V2P(mem) | ((PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W);
+    kfree(P2V(pa));
+  }
+  staleuvm(pgdir);
+  invlpg((char*)PGROUNDDOWN(va));
+  return 0;
+}
+
+// Give pgdir private copies of all its copy-on-write pages
+// below sz, before it is shared with another thread.  Pass
+// KERNBASE to include memory mappings.
+int
+uncowuvm(pde_t *pgdir, uint sz)
+{
+  pte_t *pte;
+  uint i;
+
+  for(i = 0; i < sz; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_COW)) == (PTE_P|PTE_COW) && cowfault(pgdir, i) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Resolve a fault at user address va in pgdir, which the
+// caller has checked is user memory: map mem, or a zeroed page
+// if mem is 0, with permissions perm if va has never been
+// touched (sbrk() and mmap() only reserve address space), or
+// break copy-on-write for a write.  mem is freed if it is not
+// used.  Returns -1 if the access is not allowed, -2 if memory
+// is short.  If perm has PTE_PS, va is mapped with a 4MB page,
+// and mem must be a block from kalloc_order(HUGEORDER).  A page
+// that is swapped out must be read back in by swapin() first.
+// Caller holds the address space's vmlock.
+int
+vmfault(pde_t *pgdir, uint va, int write, char *mem, int perm)
+{
+  pde_t *pde;
+  pte_t *pte;
+
+  if(va >= KERNBASE)
+    goto bad;
+  if((perm & PTE_PS) || hugepde(pgdir, va)){
+    pde = &pgdir[PDX(va)];
+    if((*pde & PTE_P) == 0){
+      if(mem == 0)
+        return -1;
+      *pde = V2P(mem) | perm | PTE_P;
+      return 0;
+    }
+    if(mem)
+      kfree_order(mem, (perm & PTE_PS) ? HUGEORDER : 0);
+    if((*pde & (PTE_PS|PTE_U)) != (PTE_PS|PTE_U))
+      return -1;
+    if(write && (*pde & PTE_W) == 0)
+      return -1;
+    // Another thread mapped the page first.
+    return 0;
+  }
+  va = PGROUNDDOWN(va);
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_SWAP))
+    goto bad;
+  if(pte == 0 || (*pte & PTE_P) == 0){
+    if(mem == 0 && (mem = kalloc_zeroed()) == 0)
+      return -2;
+    if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
       kfree(mem);
-      goto bad;
+      return -2;
     }
+    return 0;
   }
-  return d;
+  if(mem)
+    kfree(mem);
+  if((*pte & PTE_U) == 0)
+    return -1;
+  if(write && (*pte & PTE_COW))
+    return cowfault(pgdir, va);
+  if(write && (*pte & PTE_W) == 0)
+    return -1;
+  // Another thread mapped the page first.
+  return 0;
 
 bad:
-  freevm(d);
+  if(mem)
+    kfree_order(mem, (perm & PTE_PS) ? HUGEORDER : 0);
+  return -1;
+}
+
+// Return the kernel address of the user page at uva in pgdir
+// if it has been written since it was mapped, otherwise 0.
+char*
+dirtypage(pde_t *pgdir, char *uva)
+{
+  pte_t *pte;
+
+  pte = walkpgdir(pgdir, uva, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_U|PTE_D)) != (PTE_P|PTE_U|PTE_D))
+    return 0;
+  return (char*)P2V(PTE_ADDR(*pte));
+}
+
+// Clock hand step for swapout() (see swap.c): scan pgdir's
+// pages from *va up to end, clearing the accessed bit of each
+// recently used one, and stop at the first private page not
+// used since its bit was last cleared.  Give that page a swap
+// slot, replace its entry with one for the slot, and return it
+// with the reference the entry held, with *slot set and *va
+// just past it.  Returns 0 when the scan reaches end, or with
+// *va short of end if the swap area is full.  Caller holds
+// vmlock(pgdir) and makes sure no CPU is running on pgdir.
+char*
+vmevict(pde_t *pgdir, uint *va, uint end, uint *slot)
+{
+  pte_t *pte;
+  char *mem;
+  int s, stale;
+
+  mem = 0;
+  stale = 0;
+  for(; *va < end; *va += PGSIZE){
+    if(hugepde(pgdir, *va) || (pte = walkpgdir(pgdir, (char*)*va, 0)) == 0){
+      *va = PGADDR(PDX(*va) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      stale = 1;
+      continue;
+    }
+    if(krefcnt(P2V(PTE_ADDR(*pte))) != 1)
+      continue;
+    if((s = swapalloc(P2V(PTE_ADDR(*pte)))) < 0)
+      break;
+    mem = P2V(PTE_ADDR(*pte));
+    *pte = (uint)s << PTXSHIFT | (PTE_FLAGS(*pte) & ~PTE_P) | PTE_SWAP;
+    *slot = s;
+    *va += PGSIZE;
+    stale = 1;
+    break;
+  }
+  // Other CPUs may still hold the old entries in their TLBs.
+  if(stale)
+    staleuvm(pgdir);
+  return mem;
+}
+
+// Return the swap slot holding the page at va in pgdir, or -1
+// if it is not swapped out.  Caller holds vmlock(pgdir).
+int
+vmswapped(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  if(va >= KERNBASE || hugepde(pgdir, va) ||
+     (pte = walkpgdir(pgdir, (char*)va, 0)) == 0 || (*pte & PTE_SWAP) == 0)
+    return -1;
+  return PTE_ADDR(*pte) >> PTXSHIFT;
+}
+
+// Map mem, holding the contents of swap slot, at va in pgdir
+// in place of the slot, and drop the slot's reference.  The
+// page is private now, so it is writable if it was
+// copy-on-write.  Returns -1 if va no longer refers to slot.
+// Caller holds vmlock(pgdir).
+int
+vmswapin(pde_t *pgdir, uint va, int slot, char *mem)
+{
+  pte_t *pte;
+  uint flags;
+
+  if(vmswapped(pgdir, va) != slot)
+    return -1;
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  flags = PTE_FLAGS(*pte) & ~(PTE_SWAP|PTE_A|PTE_D);
+  if(flags & PTE_COW)
+    flags = (flags & ~PTE_COW) | PTE_W;
+  *pte = V2P(mem) | flags | PTE_P;
+  swapfree(slot);
   return 0;
 }
 
+// Count the user pages of pgdir that are in memory and that
+// are swapped out, and the page table pages, the directory
+// included, that map them.  Caller holds vmlock(pgdir).
+void
+vmcount(pde_t *pgdir, uint *resident, uint *swapped, uint *pgtab)
+{
+  pte_t *pte;
+  uint i, j;
+
+  *resident = *swapped = 0;
+  *pgtab = 1;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if((pgdir[i] & (PTE_P|PTE_PS)) == (PTE_P|PTE_PS)){
+      *resident += NPTENTRIES;
+      continue;
+    }
+    if((pgdir[i] & PTE_P) == 0)
+      continue;
+    (*pgtab)++;
+    pte = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if((pte[j] & (PTE_P|PTE_U)) == (PTE_P|PTE_U))
+        (*resident)++;
+      else if(pte[j] & PTE_SWAP)
+        (*swapped)++;
+    }
+  }
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
+  pde_t *pde;
   pte_t *pte;
 
+  // The 4KB part of a 4MB page holding uva.
+  if((pde = hugepde(pgdir, (uint)uva)) != 0 && (*pde & PTE_U))
+    return (char*)P2V(PTE_ADDR(*pde)) + PGROUNDDOWN((uint)uva % HUGEPGSIZE);
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -361,16 +801,26 @@ uva2ka(pde_t *pgdir, char *uva)
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
-// uva2ka ensures this only works for PTE_U pages.
+// uva2ka ensures this only works for PTE_U pages.  The caller
+// must have checked that the range lies below the process's
+// size and must hold its vmlock if other threads share pgdir.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // Writing through the kernel mapping does not fault, so
+    // map untouched pages and break copy-on-write first.
+    if(va0 < KERNBASE && !hugepde(pgdir, va0) &&
+       ((pte = walkpgdir(pgdir, (char*)va0, 0)) == 0 ||
+        (*pte & (PTE_P|PTE_COW)) != PTE_P) &&
+       vmfault(pgdir, va0, 1, 0, PTE_W|PTE_U) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
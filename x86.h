@@ -130,6 +130,44 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically replace *addr with newval if it equals oldval.
+// Returns the value *addr held before the operation.
+static inline uint
+cmpxchg(volatile uint *addr, uint oldval, uint newval)
+{
+  uint result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (oldval) :
+               "cc");
+  return result;
+}
+
+// Hint to the processor that this is a spin-wait loop.
+static inline void
+pause(void)
+{
+  asm volatile("pause");
+}
+
+// Read the processor's time-stamp counter.
+static inline uint64
+rdtsc(void)
+{
+  uint64 tsc;
+
+  asm volatile("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+// Write v to model-specific register msr.
+static inline void
+wrmsr(uint msr, uint64 v)
+{
+  asm volatile("wrmsr" : : "c" (msr), "A" (v));
+}
+
 static inline uint
 rcr2(void)
 {
@@ -144,6 +182,13 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+// Flush the TLB entry for one virtual address.
+static inline void
+invlpg(void *va)
+{
+  asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().